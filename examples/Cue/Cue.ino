@@ -0,0 +1,86 @@
+#include <AidtopiaSerialAudio.h>
+
+// This example runs a fixed sequence of audio steps, called a cue,
+// each time a button is pressed.  The library works through the
+// steps by itself, so the sketch doesn't need a state machine in
+// its hooks.
+//
+// I recommend you read through the Playlist example first.
+//
+// Cues and background queries are optional features, so build
+// with these compiler flags (see extras/footprint.md for how):
+//
+//   -DAIDTOPIA_SERIALAUDIO_CUE=1
+//   -DAIDTOPIA_SERIALAUDIO_BACKGROUND_TASKS=1
+#if !AIDTOPIA_SERIALAUDIO_CUE || !AIDTOPIA_SERIALAUDIO_BACKGROUND_TASKS
+#error "This example needs cues and background queries turned on."
+#endif
+
+AidtopiaSerialAudio audio;
+
+// A cue's steps are a list of bytes.  Each step is an opcode
+// followed by its numbers.  Numbers that can be bigger than 255
+// (like the length of a WAIT) take two bytes, high byte first.
+// PROGMEM keeps the list in flash, so a long cue costs almost no
+// RAM.
+using Cue = AidtopiaSerialAudio::Cue;
+static uint8_t const greeting[] PROGMEM = {
+  // Start at a moderate volume.
+  Cue::VOLUME, 20,
+
+  // Play the file in folder "03" that starts with "007".
+  Cue::PLAY_FOLDER, 3, 7,
+
+  // Wait until it's done.
+  Cue::WAIT_FINISHED,
+
+  // Play "0001" from the "MP3" folder, and let it play for 4.5
+  // seconds before fading out a step every 100 ms.
+  Cue::PLAY_TRACK, 0, 1,
+  Cue::WAIT, 4500 >> 8, 4500 & 0xFF,
+  Cue::RAMP, 0, 100,
+  Cue::STOP,
+  Cue::END
+};
+
+// The Cue remembers where it is in the script.  It's only a few
+// bytes, so a sketch can have several of them.
+Cue cue(greeting);
+
+constexpr int buttonPin = 2;
+bool ready = false;
+
+class CueHooks : public AidtopiaSerialAudio::Hooks {
+  public:
+    void onInitComplete(Devices devices) override {
+      if (!devices.has(Device::SDCARD)) {
+        Serial.println("There's no SD card in the audio player.");
+        return;
+      }
+      audio.selectSource(Device::SDCARD);
+      ready = true;
+    }
+};
+
+CueHooks myHooks;
+
+void setup() {
+  Serial.begin(115200);
+  Serial.println(F("Cue example for AidtopiaSerialAudio"));
+  pinMode(buttonPin, INPUT_PULLUP);
+  audio.begin(Serial1);
+
+  // In case a FINISHED notification gets lost, check the status
+  // every few seconds.  (See the comments on `runCue`.)
+  audio.addBackgroundQuery(AidtopiaSerialAudio::Parameter::STATUS, 5000);
+}
+
+void loop() {
+  audio.update(myHooks);
+
+  // Start the cue when the button is pressed, unless it's already
+  // running.  Starting it again would begin from the top.
+  if (ready && digitalRead(buttonPin) == LOW && !audio.runningCue()) {
+    audio.runCue(cue);
+  }
+}
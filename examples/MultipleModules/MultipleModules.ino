@@ -0,0 +1,50 @@
+#include <AidtopiaSerialAudioGroup.h>
+
+// This example demonstrates driving several audio modules at once, each
+// wired to its own serial port.  It requires a board with several hardware
+// serial ports, like an Arduino Mega.
+//
+// I recommend you read through the FireAndForget and Playlist examples
+// first.
+
+// A group of three modules.
+AidtopiaSerialAudioGroup<3> modules;
+
+// Each module can have its own hooks.  Here, each module simply
+// starts playing a track once it's initialized.
+class StartupHooks : public AidtopiaSerialAudio::Hooks {
+  public:
+    explicit StartupHooks(uint8_t index) : m_index(index) {}
+
+    void onInitComplete(Devices /*devices*/) override {
+      // Each module plays a different track.
+      modules[m_index].playTrack(m_index + 1);
+    }
+
+  private:
+    uint8_t m_index;
+};
+
+StartupHooks hooks0(0);
+StartupHooks hooks1(1);
+StartupHooks hooks2(2);
+
+void setup() {
+  Serial.begin(115200);
+  Serial.println(F("MultipleModules example for AidtopiaSerialAudio"));
+
+  modules.begin(0, Serial1);
+  modules.begin(1, Serial2);
+  modules.begin(2, Serial3);
+
+  modules.setHooks(0, hooks0);
+  modules.setHooks(1, hooks1);
+  modules.setHooks(2, hooks2);
+}
+
+void loop() {
+  // A single update services all of the modules.  If loop() has other
+  // time-sensitive work, you can pass a smaller budget, like
+  // `modules.update(1)`, to service one module per pass.
+  modules.update();
+}
@@ -1,20 +1,35 @@
 #include <AidtopiaSerialAudio.h>
 
-// This example demonstrates the use of callback hooks to implement a
-// playlist with AidtopiaSerialAudio.
+// This example demonstrates playing a playlist with
+// AidtopiaSerialAudio.
 //
 // I recommend you read through the FireAndForget example first.
+//
+// Playlists are an optional feature, so build with the compiler
+// flag -DAIDTOPIA_SERIALAUDIO_PLAYLIST=1 (see extras/footprint.md
+// for how).
+#if !AIDTOPIA_SERIALAUDIO_PLAYLIST
+#error "This example needs playlists turned on."
+#endif
 
 AidtopiaSerialAudio audio;
 
-// Let's make a playlist.
-int const playlist[] = {2, 1, 3};
-auto constexpr playlistSize = sizeof(playlist) / sizeof(playlist[0]);
-int playlistPosition = 0;  // current position in the list
+// Let's make a playlist of tracks from the "MP3" folder.  The
+// playlist refers to this array rather than copying it, so the
+// array must stick around as long as the playlist is in use.
+uint16_t const tracks[] = {2, 1, 3};
+auto constexpr trackCount = sizeof(tracks) / sizeof(tracks[0]);
+AidtopiaSerialAudio::Playlist playlist =
+  AidtopiaSerialAudio::Playlist::ofTracks(tracks, trackCount);
+
+// There are other kinds of playlists, too.  For example, to play
+// the files in folder "01" that start with "001" through "012",
+// you could use:
+//
+//   AidtopiaSerialAudio::Playlist::folder(1, 1, 12);
 
-// To work through the playlist, we'll need to know when to start
-// playing the first track, and when to play the next track.  For
-// that, we'll use callback hooks.
+// We need to know when the module is ready before we start
+// playing, so we'll use a callback hook.
 
 // Derive a class from AidtopiaSerialAudio::Hooks that overrides the
 // callback methods we care about.
@@ -29,48 +44,31 @@ class PlaylistHooks : public AidtopiaSerialAudio::Hooks {
         Serial.println("There's no SD card in the audio player.");
         return;
       }
-    
+
       // Select the SD card as the storage device we want to play
       // the tracks from.  It's possible that the SD card is already
       // the selected storage device.  Heck, it might even be the
       // only device.  But there's no harm in selecting it
       // explicitly.
       audio.selectSource(Device::SDCARD);
-      
-      if (playlistSize == 0) {
+
+      if (playlist.size() == 0) {
         Serial.println("There's nothing in the playlist.");
         return;
       }
 
-      // Also queue up a command to play the first track in our
-      // playlist.
-      playlistPosition = 0;
-      audio.playTrack(playlist[playlistPosition]);
-
-      // Update playlistPosition to the next position.
-      // The `% playlistSize` makes it wrap around, so once the last
-      // track has played, it'll start over with the first one.
-      playlistPosition = (playlistPosition + 1) % playlistSize;
-    }
-
-    // This method will be called when a file has finished playing.
-    void onFinishedFile(Device /*device*/, uint16_t /*index*/) override {
-      // `device` is the device that the file was playing from.
-      // `index` is the filesystem index of the file that finished
-      // playing.  We don't care about either of these, so I've
-      // commented out the names from the function signature.
-
-      if (playlistSize == 0) return;
+      // Once the last track has played, start over with the first
+      // one.  (Try `setShuffle(true)`, too.)
+      playlist.setRepeat(AidtopiaSerialAudio::Playlist::Repeat::ALL);
 
-      // Queue up a command to play the next track in our playlist.
-      audio.playTrack(playlist[playlistPosition]);
-      
-      // Update our position in the playlist.
-      playlistPosition = (playlistPosition + 1) % playlistSize;
+      // Queue up the playlist.  From here on, the library starts
+      // each track as soon as the module says the previous one has
+      // finished.
+      audio.play(playlist);
     }
 
-    // There are a few more callbacks you can override, but they
-    // aren't necessary for this example.
+    // If you want to know when each track finishes, you can also
+    // override `onFinishedFile`.  The playlist doesn't need it.
 };
 
 // We'll need an instance of our PlaylistHooks.
@@ -0,0 +1,90 @@
+#include "Arduino.h"
+#include <chrono>
+#include <stdio.h>
+
+HostSerial Serial;
+
+namespace {
+
+using SteadyClock = std::chrono::steady_clock;
+
+SteadyClock::time_point const g_start = SteadyClock::now();
+bool g_manual = false;
+uint64_t g_manualMicros = 0;
+
+}
+
+namespace host {
+
+void useManualClock(uint64_t startMicros) {
+    g_manual = true;
+    g_manualMicros = startMicros;
+}
+
+void useRealClock() { g_manual = false; }
+
+void advanceMicros(uint32_t delta) { g_manualMicros += delta; }
+
+}
+
+uint32_t micros() {
+    if (g_manual) return static_cast<uint32_t>(g_manualMicros);
+    auto const elapsed = SteadyClock::now() - g_start;
+    return static_cast<uint32_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+}
+
+uint32_t millis() {
+    if (g_manual) return static_cast<uint32_t>(g_manualMicros / 1000u);
+    auto const elapsed = SteadyClock::now() - g_start;
+    return static_cast<uint32_t>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+}
+
+void pinMode(uint8_t, uint8_t) {}
+int digitalRead(uint8_t) { return HIGH; }
+
+size_t HostSerial::write(uint8_t b) {
+    return fputc(b, stdout) == EOF ? 0 : 1;
+}
+
+size_t Print::print(char const *s) {
+    return write(reinterpret_cast<uint8_t const *>(s), strlen(s));
+}
+
+size_t Print::print(__FlashStringHelper const *s) {
+    return print(reinterpret_cast<char const *>(s));
+}
+
+size_t Print::print(char c) { return write(static_cast<uint8_t>(c)); }
+
+size_t Print::print(unsigned long value, int base) {
+    char buf[8 * sizeof(value) + 1];
+    char *p = buf + sizeof(buf);
+    *--p = '\0';
+    do {
+        auto const digit = static_cast<char>(value % base);
+        *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+        value /= base;
+    } while (value != 0);
+    return print(p);
+}
+
+size_t Print::print(long value, int base) {
+    if (value < 0 && base == DEC) {
+        return print('-') + print(static_cast<unsigned long>(-value), base);
+    }
+    return print(static_cast<unsigned long>(value), base);
+}
+
+size_t Print::print(unsigned value, int base) {
+    return print(static_cast<unsigned long>(value), base);
+}
+
+size_t Print::print(int value, int base) {
+    return print(static_cast<long>(value), base);
+}
+
+size_t Print::print(unsigned char value, int base) {
+    return print(static_cast<unsigned long>(value), base);
+}
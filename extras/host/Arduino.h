@@ -0,0 +1,127 @@
+// Host-side stand-in for the Arduino core
+// Adrian McCarthy 2018-
+
+// This provides just enough of the Arduino API to compile the library on a
+// desktop machine so that it can be exercised against the module emulator.
+// It is not part of the library and is not used by Arduino builds.
+
+#ifndef AIDTOPIA_HOST_ARDUINO_H
+#define AIDTOPIA_HOST_ARDUINO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+
+typedef uint8_t byte;
+
+#define HEX 16
+#define DEC 10
+
+#define LOW  0
+#define HIGH 1
+#define INPUT        0x0
+#define OUTPUT       0x1
+#define INPUT_PULLUP 0x2
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*reinterpret_cast<uint8_t const *>(addr))
+#define pgm_read_word(addr) (*reinterpret_cast<uint16_t const *>(addr))
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<__FlashStringHelper const *>(s))
+
+// Like an AVR or ARM board, the clocks are 32 bits wide.
+uint32_t millis();
+uint32_t micros();
+
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+
+// There are no interrupts on the host, so handlers are never called.
+#define CHANGE 1
+#define digitalPinToInterrupt(pin) (pin)
+inline void attachInterrupt(uint8_t, void (*)(), int) {}
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+template <typename A, typename B>
+typename std::common_type<A, B>::type min(A a, B b) { return a < b ? a : b; }
+template <typename A, typename B>
+typename std::common_type<A, B>::type max(A a, B b) { return a < b ? b : a; }
+
+class Print {
+    public:
+        virtual ~Print() {}
+
+        virtual size_t write(uint8_t b) = 0;
+        virtual size_t write(uint8_t const *buf, size_t len) {
+            size_t n = 0;
+            while (n < len && write(buf[n]) == 1) ++n;
+            return n;
+        }
+        virtual int availableForWrite() { return 0; }
+        virtual void flush() {}
+
+        size_t print(char const *s);
+        size_t print(__FlashStringHelper const *s);
+        size_t print(char c);
+        size_t print(unsigned long value, int base = DEC);
+        size_t print(long value, int base = DEC);
+        size_t print(unsigned value, int base = DEC);
+        size_t print(int value, int base = DEC);
+        size_t print(unsigned char value, int base = DEC);
+
+        size_t println() { return print('\n'); }
+        template <typename T>
+        size_t println(T value) { return print(value) + println(); }
+        template <typename T>
+        size_t println(T value, int base) {
+            return print(value, base) + println();
+        }
+};
+
+class Stream : public Print {
+    public:
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int peek() = 0;
+};
+
+// `Serial` writes to stdout and never has input.
+class HostSerial : public Stream {
+    public:
+        void begin(unsigned long /*baudrate*/) {}
+        using Print::write;
+        size_t write(uint8_t b) override;
+        int availableForWrite() override { return 64; }
+        int available() override { return 0; }
+        int read() override { return -1; }
+        int peek() override { return -1; }
+};
+
+extern HostSerial Serial;
+
+namespace host {
+
+// By default, millis() and micros() follow the host's monotonic clock.  A
+// simulation can switch to a manual clock, which changes only when the
+// simulation advances it.  The manual clock counts in 64 bits, so millis()
+// and micros() each roll over at their own 32-bit boundary, just as they do
+// on a board.
+void useManualClock(uint64_t startMicros = 0);
+void useRealClock();
+void advanceMicros(uint32_t delta);
+inline void advanceMillis(uint32_t delta) { advanceMicros(1000u * delta); }
+
+// A millisecond clock for SerialAudio that's only 16 bits wide, so it rolls
+// over every 65.5 seconds instead of every 49.7 days.  To use it, build
+// everything (the library included) with
+// -DAIDTOPIA_SERIALAUDIO_CLOCK=::host::Millis16Clock.
+struct Millis16Clock {
+    static uint16_t now() { return static_cast<uint16_t>(millis()); }
+};
+
+}
+
+#endif
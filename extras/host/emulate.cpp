@@ -0,0 +1,634 @@
+// Runs SerialAudio against emulated modules and reports how long common
+// operations take, from the moment the sketch asks until the module acts or
+// the answer arrives.  Everything runs on the manual clock, so it finishes
+// almost instantly.
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <string.h>
+#include <functional>
+#include "AidtopiaSerialAudio.h"
+#include "emulator.h"
+
+// The bench tries every optional feature, so build it with all of them on
+// (see README.md).
+#if !AIDTOPIA_SERIALAUDIO_MIRROR || !AIDTOPIA_SERIALAUDIO_FOLDER_INDEX || \
+    !AIDTOPIA_SERIALAUDIO_BACKGROUND_TASKS || !AIDTOPIA_SERIALAUDIO_CUE || \
+    !AIDTOPIA_SERIALAUDIO_PLAYLIST || !AIDTOPIA_SERIALAUDIO_VARIANT_PROBE || \
+    !AIDTOPIA_SERIALAUDIO_EVENT_QUEUE_DEPTH
+#error "emulate.cpp needs the optional features turned on (see README.md)"
+#endif
+
+using aidtopia::FolderIndex;
+using aidtopia::IndexStorage;
+using aidtopia::SerialAudio;
+using aidtopia::host::EmulatedBusyLine;
+using aidtopia::host::Media;
+using aidtopia::host::ModuleEmulator;
+using aidtopia::host::ModuleProfile;
+
+namespace {
+
+class RecordingHooks : public SerialAudio::Hooks {
+    public:
+        void clear() { m_answered = false; m_initialized = false; }
+        void clearFinished() {
+            m_finished = 0; m_finishedMask = 0; m_advertFinished = false;
+        }
+        unsigned finished() const { return m_finished; }
+        uint32_t finishedMask() const { return m_finishedMask; }
+        bool advertFinished() const { return m_advertFinished; }
+        bool answered() const { return m_answered; }
+        bool initialized() const { return m_initialized; }
+        uint16_t value() const { return m_value; }
+        bool failed() const { return m_failed; }
+        Error error() const { return m_error; }
+        ID errorFor() const { return m_errorFor; }
+
+    private:
+        void onError(Error code, ID msgid) override {
+            m_answered = true; m_failed = true; m_error = code;
+            m_errorFor = msgid;
+        }
+        void onQueryResponse(Parameter, uint16_t value) override {
+            m_answered = true; m_failed = false; m_value = value;
+        }
+        void onInitComplete(Devices) override { m_initialized = true; }
+        void onFinishedFile(Device, uint16_t index) override {
+            ++m_finished;
+            if (index < 32) m_finishedMask |= 1ul << index;
+        }
+        void onAdvertFinished() override { m_advertFinished = true; }
+
+        bool     m_answered = false;
+        bool     m_initialized = false;
+        bool     m_failed = false;
+        uint16_t m_value = 0;
+        Error    m_error = Error::UNSUPPORTED;
+        ID       m_errorFor = ID::NONE;
+        unsigned m_finished = 0;
+        uint32_t m_finishedMask = 0;
+        bool     m_advertFinished = false;
+};
+
+// Stands in for EEPROM so that a FolderIndex can outlive a Bench.
+class MemoryStorage : public IndexStorage {
+    public:
+        bool load(uint8_t *data, uint16_t size) override {
+            if (!m_saved || size > sizeof(m_data)) return false;
+            memcpy(data, m_data, size);
+            return true;
+        }
+        void save(uint8_t const *data, uint16_t size) override {
+            if (size > sizeof(m_data)) return;
+            memcpy(m_data, data, size);
+            m_saved = true;
+        }
+
+    private:
+        uint8_t m_data[128];
+        bool    m_saved = false;
+};
+
+class Bench {
+    public:
+        explicit Bench(ModuleProfile const &profile, bool deferred = false,
+                       FolderIndex *index = nullptr) :
+            m_module(profile), m_busyLine(m_module), m_deferred(deferred)
+        {
+            m_module.insertDevice(0x02, Media{10, 20, 50, 5});
+            m_module.powerOn();
+            if (index != nullptr) m_audio.useIndex(*index);
+            m_audio.begin(m_module);
+            m_audio.deferEvents(deferred);
+        }
+
+        // Runs the simulation in 100 us steps until `done` returns true or
+        // `limit` milliseconds have passed.  Returns the elapsed time in
+        // milliseconds or -1 if it gave up.
+        template <typename Predicate>
+        long runUntil(Predicate done, uint32_t limit = 5000) {
+            auto const start = micros();
+            while (micros() - start < 1000u * limit) {
+                m_audio.update(m_hooks);
+                m_audio.pollEvents(m_hooks);
+                if (done()) return (micros() - start + 500u) / 1000u;
+                ::host::advanceMicros(100);
+            }
+            return -1;
+        }
+
+        void report(char const *what, long elapsed) {
+            if (elapsed < 0) {
+                printf("  %-28s gave up\n", what);
+            } else if (m_hooks.answered() && m_hooks.failed()) {
+                printf("  %-28s %5ld ms  (error 0x%X)\n", what, elapsed,
+                       static_cast<unsigned>(m_hooks.error()));
+            } else {
+                printf("  %-28s %5ld ms\n", what, elapsed);
+            }
+        }
+
+        template <typename Request>
+        void query(char const *what, Request request) {
+            m_hooks.clear();
+            request(m_audio);
+            report(what, runUntil([this] { return m_hooks.answered(); }));
+        }
+
+        template <typename Request, typename Predicate>
+        void command(char const *what, Request request, Predicate effect) {
+            m_hooks.clear();
+            request(m_audio);
+            report(what, runUntil([&] { return effect(m_module); }));
+            // Let the state machine finish with the command before the next.
+            runUntil([] { return false; }, 400);
+        }
+
+        // Builds a track map the way a sketch would:  the folder count, then
+        // the number of files in each folder.
+        void mapFolders(char const *label) {
+            printf("%s (%s index)\n", m_module.profile().name, label);
+            m_hooks.clear();
+            report("power-up to init complete",
+                   runUntil([this] { return m_hooks.initialized(); }));
+            long total = 0;
+            for (uint16_t folder = 0; folder <= 10; ++folder) {
+                m_hooks.clear();
+                if (folder == 0) {
+                    m_audio.queryFolderCount();
+                } else {
+                    m_audio.queryFolderFileCount(folder);
+                }
+                auto const elapsed =
+                    runUntil([this] { return m_hooks.answered(); });
+                if (elapsed < 0) { total = -1; break; }
+                total += elapsed;
+            }
+            report("folder count + 10 folders", total);
+            printf("\n");
+        }
+
+        // Plays a playlist of short files and reports how much silence the
+        // library leaves between them.  `files` is a bitmask of the files
+        // that should play.
+        void playlist(char const *what, SerialAudio::Playlist list,
+                      bool onModule, uint32_t files) {
+            constexpr uint32_t trackLength = 1000;
+            m_module.setTrackLength(trackLength);
+            m_hooks.clearFinished();
+            if (onModule) m_audio.playOnModule(list); else m_audio.play(list);
+            auto const elapsed = runUntil([this] {
+                return !m_audio.playingPlaylist() && !m_module.playing();
+            }, 20000);
+            // The last FINISHED may trail the end of the playlist.
+            runUntil([] { return false; }, 100);
+            if (elapsed < 0 || m_hooks.finishedMask() != files) {
+                printf("  %-28s failed\n", what);
+            } else {
+                long const count = list.size();
+                printf("  %-28s %5ld ms gap per file\n", what,
+                       (elapsed - count * static_cast<long>(trackLength)) / count);
+            }
+        }
+
+#if AIDTOPIA_SERIALAUDIO_BUSY
+        // Follows playback with the BUSY line instead of waiting for the
+        // FINISHED notifications.
+        void busyLine() {
+            printf("%s (BUSY line)\n", m_module.profile().name);
+            m_audio.useBusySource(&m_busyLine);
+            m_hooks.clear();
+            report("power-up to init complete",
+                   runUntil([this] { return m_hooks.initialized(); }));
+            auto shuffled = SerialAudio::Playlist::fileRange(1, 8);
+            shuffled.setShuffle(true);
+            playlist("shuffled playlist", shuffled, false, 0x1FEul);
+            m_module.setTrackLength(5000);
+            m_module.setAdvertLength(1000);
+            command("playTrack(1, 1)",
+                    [](SerialAudio &a) { a.playTrack(1, 1); },
+                    [](ModuleEmulator &m) { return m.playing() && m.currentFile() == 1; });
+            m_hooks.clearFinished();
+            m_audio.insertAdvert(1);
+            report("1000 ms advert to finished",
+                   runUntil([this] { return m_hooks.advertFinished(); }));
+            printf("\n");
+        }
+#endif
+
+        // Runs a cue from flash:  play a track, interrupt it with an advert,
+        // wait for the track to finish, and fade out.
+        void cue() {
+            using Cue = SerialAudio::Cue;
+            static uint8_t const script[] PROGMEM = {
+                Cue::VOLUME, 20,
+                Cue::SOURCE, static_cast<uint8_t>(SerialAudio::Device::SDCARD),
+                Cue::PLAY_FOLDER, 3, 7,
+                Cue::WAIT, 500 >> 8, 500 & 0xFF,
+                Cue::ADVERT, 0, 1,
+                Cue::WAIT_FINISHED,
+                Cue::RAMP, 0, 20,
+                Cue::END
+            };
+            printf("%s (cue)\n", m_module.profile().name);
+            m_hooks.clear();
+            runUntil([this] { return m_hooks.initialized(); });
+            runUntil([] { return false; }, 500);
+            m_module.setTrackLength(2000);
+            m_module.setAdvertLength(1000);
+            char const *const runs[] = {
+                "play, advert, fade out",
+#if AIDTOPIA_SERIALAUDIO_BUSY
+                "... with BUSY"
+#endif
+            };
+            for (auto const *what : runs) {
+                m_hooks.clearFinished();
+                Cue cue(script);
+                m_audio.runCue(cue);
+                auto const elapsed =
+                    runUntil([this] { return !m_audio.runningCue(); }, 10000);
+                // The cue is over once its last command is queued.
+                runUntil([] { return false; }, 200);
+                if (elapsed < 0 || m_hooks.finished() == 0 ||
+                    m_module.volume() != 0
+                ) {
+                    printf("  %-28s failed\n", what);
+                } else {
+                    printf("  %-28s %5ld ms\n", what, elapsed);
+                }
+#if AIDTOPIA_SERIALAUDIO_BUSY
+                m_audio.useBusySource(&m_busyLine);
+#endif
+            }
+            printf("\n");
+        }
+
+        // An error that shows up after the last request was answered isn't
+        // a reason to send that request again.
+        void idleError() {
+            m_audio.playFile(12);
+            runUntil([] { return false; }, 200);
+            auto const sent = m_module.framesReceived();
+            m_hooks.clear();
+            m_module.sendError(0x03);  // SERIALERROR
+            runUntil([] { return false; }, 1000);
+            printf("  %-28s %5u resent  (%s)\n", "error while idle",
+                   static_cast<unsigned>(m_module.framesReceived() - sent),
+                   !m_hooks.answered() ? "not reported" :
+                   m_hooks.error() == SerialAudio::Error::SERIALERROR ?
+                       "reported" : "reported as something else");
+        }
+
+        // Errors for commands sent without feedback.  One that arrives during
+        // the gap after such a command is about that command.  One that
+        // arrives after several can't be pinned on any of them.
+        void unconfirmedErrors() {
+            m_audio.disableFeedback(SerialAudio::CommandClass::VOLUME);
+            m_audio.disableFeedback(SerialAudio::CommandClass::EQ);
+            auto report = [this](char const *what, uint32_t sent) {
+                printf("  %-28s %5u resent  (%s)\n", what,
+                       static_cast<unsigned>(m_module.framesReceived() - sent),
+                       !m_hooks.answered() ? "not reported" :
+                       m_hooks.errorFor() == aidtopia::Message::ID::SETVOLUME ?
+                           "blamed on setVolume" :
+                       m_hooks.errorFor() == aidtopia::Message::ID::NONE ?
+                           "blamed on nothing" : "blamed on something else");
+            };
+            auto sent = m_module.framesReceived();
+            m_hooks.clear();
+            m_audio.setVolume(10);
+            runUntil([this, sent] { return m_module.framesReceived() > sent; });
+            m_module.sendError(0x03);  // SERIALERROR
+            runUntil([] { return false; }, 1000);
+            report("error in the gap", sent + 1);
+            sent = m_module.framesReceived();
+            m_hooks.clear();
+            m_audio.setVolume(12);
+            m_audio.setEqProfile(SerialAudio::EqProfile::ROCK);
+            runUntil([this, sent] { return m_module.framesReceived() > sent + 1; });
+            m_module.sendError(0x03);
+            runUntil([] { return false; }, 1000);
+            report("error after two", sent + 2);
+            m_audio.enableFeedback(SerialAudio::CommandClass::VOLUME);
+            m_audio.enableFeedback(SerialAudio::CommandClass::EQ);
+        }
+
+        // A transmitter that stops taking bytes mustn't stall the library.
+        // The request times out, and once the port works again, so does the
+        // library.
+        void jammedPort() {
+            m_module.jamTransmitter(true);
+            query("queryVolume, port jammed",
+                  [](SerialAudio &a) { a.queryVolume(); });
+            m_module.jamTransmitter(false);
+            query("queryVolume, port unjammed",
+                  [](SerialAudio &a) { a.queryVolume(); });
+        }
+
+        // The sketch's query cuts in on a background query for the same
+        // thing.  The background query's late answer (with the old volume)
+        // mustn't be taken for the sketch's.
+        void abandonedQuery() {
+            m_audio.addBackgroundQuery(SerialAudio::Parameter::VOLUME, 250);
+            auto const sent = m_module.framesReceived();
+            runUntil([this, sent] { return m_module.framesReceived() > sent; },
+                     1000);
+            m_audio.disableFeedback(SerialAudio::CommandClass::VOLUME);
+            m_hooks.clear();
+            m_audio.setVolume(21);
+            m_audio.queryVolume();
+            runUntil([this] { return m_hooks.answered(); });
+            printf("  %-28s %5u  (module: %u)\n", "queryVolume over background",
+                   m_hooks.value(), m_module.volume());
+            m_audio.enableFeedback(SerialAudio::CommandClass::VOLUME);
+            m_audio.clearBackgroundQueries();
+        }
+
+        // Follows a few requests by their tickets instead of the hooks.
+        void tickets() {
+            printf("%s (tickets)\n", m_module.profile().name);
+            runUntil([this] { return m_hooks.initialized(); });
+            runUntil([] { return false; }, 500);
+            struct Request { char const *what; SerialAudio::Ticket ticket; };
+            Request requests[] = {
+                {"pause",                   m_audio.pause()},
+                {"setVolume(15)",           m_audio.setVolume(15)},
+                {"increaseVolume, combined", m_audio.increaseVolume()},
+                {"queryVolume",             m_audio.queryVolume()},
+                {"playTrack(20, 9), missing", SerialAudio::Ticket{}},
+                {"queryVolume, reply lost", SerialAudio::Ticket{}},
+                {"setVolume+playFile, stop", SerialAudio::Ticket{}},
+                {"playFile, loop, stop",    SerialAudio::Ticket{}},
+                {"loopCurrentTrack, stop",  SerialAudio::Ticket{}},
+                {"stop, queued at reset",   SerialAudio::Ticket{}},
+                {"reset",                   SerialAudio::Ticket{}}
+            };
+            runUntil([] { return false; }, 1000);
+            requests[4].ticket = m_audio.playTrack(20, 9);
+            runUntil([] { return false; }, 1000);
+            m_audio.setRetryPolicy(0);
+            m_module.loseOutgoing(1);
+            requests[5].ticket = m_audio.queryVolume();
+            runUntil([] { return false; }, 3000);
+            // Selecting the source makes the library wait a moment after
+            // the ACK, so what follows is still queued when the stop comes.
+            // The stop cancels a track it would cut off, but not the volume
+            // change that came with it, nor a track that a loop depends on.
+            m_audio.selectSource(SerialAudio::Device::SDCARD);
+            runUntil([] { return false; }, 50);
+            m_audio.setVolume(18);
+            requests[6].ticket = m_audio.playFile(3);
+            m_audio.stop();
+            runUntil([] { return false; }, 3000);
+            m_audio.selectSource(SerialAudio::Device::SDCARD);
+            runUntil([] { return false; }, 50);
+            requests[7].ticket = m_audio.playFile(4);
+            requests[8].ticket = m_audio.loopCurrentTrack();
+            m_audio.stop();
+            runUntil([] { return false; }, 3000);
+            m_audio.selectSource(SerialAudio::Device::SDCARD);
+            runUntil([] { return false; }, 50);
+            requests[9].ticket = m_audio.stop();
+            requests[10].ticket = m_audio.reset();
+            runUntil([] { return false; }, 3000);
+            static char const *const statuses[] = {
+                "unknown", "pending", "sent", "acked", "failed", "timed out",
+                "dropped"
+            };
+            for (auto const &request : requests) {
+                auto const status = m_audio.ticketStatus(request.ticket);
+                printf("  %-28s ticket %3u  %s\n", request.what,
+                       static_cast<unsigned>(request.ticket),
+                       statuses[static_cast<unsigned>(status)]);
+            }
+            printf("\n");
+        }
+
+#if AIDTOPIA_SERIALAUDIO_STATS
+        void printStats() const {
+            using aidtopia::Message;
+            using aidtopia::ProtocolStats;
+            auto const &stats = m_audio.stats();
+            printf("  stats:  msg  sent  latency <4 <8 <16 <32 <64 <128 <256 more\n");
+            for (unsigned id = 0; id < 0x100; ++id) {
+                auto const *entry = stats.forMessage(static_cast<Message::ID>(id));
+                if (entry == nullptr || entry->sent == 0) continue;
+                printf("          0x%02X %5u         ", id, entry->sent);
+                for (auto const count : entry->latency) printf(" %3u", count);
+                printf("\n");
+            }
+            printf("  %u timeouts, %u failed background queries, "
+                   "%u unexpected ACKs, %u unexpected responses, "
+                   "%u checksum failures, %u resyncs\n",
+                   stats.timeouts, stats.backgroundFailures,
+                   stats.unexpectedAcks,
+                   stats.unexpectedResponses, stats.checksumFailures,
+                   stats.resyncs);
+            printf("  high water:  %u commands, %u queries, %u events\n",
+                   stats.commandHighWater, stats.queryHighWater,
+                   stats.eventHighWater);
+        }
+#endif
+
+        void run() {
+            printf("%s%s\n", m_module.profile().name,
+                   m_deferred ? " (deferred events)" : "");
+            m_hooks.clear();
+            report("power-up to init complete",
+                   runUntil([this] { return m_hooks.initialized(); }));
+            auto const identified = runUntil([this] {
+                return m_audio.variant() != SerialAudio::Variant::UNKNOWN;
+            }, 500);
+            static char const *const variants[] = {
+                "unknown", "DFPlayer Mini", "Catalex", "clone"
+            };
+            if (identified < 0) {
+                // A module that isn't recognized stays UNKNOWN.
+                printf("  %-28s unknown\n", "identify variant");
+            } else {
+                printf("  %-28s %5ld ms  (%s)\n", "identify variant",
+                       identified,
+                       variants[static_cast<unsigned>(m_audio.variant())]);
+            }
+            query("queryFirmwareVersion",
+                  [](SerialAudio &a) { a.queryFirmwareVersion(); });
+            query("queryFileCount(SDCARD)",
+                  [](SerialAudio &a) { a.queryFileCount(SerialAudio::Device::SDCARD); });
+            query("queryFolderFileCount(3)",
+                  [](SerialAudio &a) { a.queryFolderFileCount(3); });
+            command("setVolume(18)",
+                    [](SerialAudio &a) { a.setVolume(18); },
+                    [](ModuleEmulator &m) { return m.volume() == 18; });
+            command("playTrack(2, 5)",
+                    [](SerialAudio &a) { a.playTrack(2, 5); },
+                    [](ModuleEmulator &m) { return m.playing() && m.currentFile() == 25; });
+            command("3 x setVolume, playFile",
+                    [](SerialAudio &a) {
+                        a.setVolume(10); a.setVolume(12); a.setVolume(14);
+                        a.playFile(7);
+                    },
+                    [](ModuleEmulator &m) { return m.playing() && m.currentFile() == 7; });
+            command("4 x increaseVolume",
+                    [](SerialAudio &a) {
+                        a.setVolume(5);
+                        for (int i = 0; i < 4; ++i) a.increaseVolume();
+                    },
+                    [](ModuleEmulator &m) { return m.volume() == 9; });
+            m_audio.disableFeedback(SerialAudio::CommandClass::VOLUME);
+            command("... without feedback",
+                    [](SerialAudio &a) {
+                        a.setVolume(20);
+                        for (int i = 0; i < 4; ++i) a.increaseVolume();
+                    },
+                    [](ModuleEmulator &m) { return m.volume() == 24; });
+            m_audio.enableFeedback(SerialAudio::CommandClass::VOLUME);
+            command("stop behind 3 queries",
+                    [](SerialAudio &a) {
+                        a.queryStatus(); a.queryVolume(); a.queryEqProfile();
+                        a.stop();
+                    },
+                    [](ModuleEmulator &m) { return !m.playing(); });
+            m_module.garbleIncoming(1);
+            command("setVolume(12), garbled once",
+                    [](SerialAudio &a) { a.setVolume(12); },
+                    [](ModuleEmulator &m) { return m.volume() == 12; });
+            idleError();
+            unconfirmedErrors();
+            jammedPort();
+            m_module.loseOutgoing(3);
+            query("queryVolume, 3 replies lost",
+                  [](SerialAudio &a) { a.queryVolume(); });
+            m_module.loseOutgoing(1);
+            query("queryVolume, reply lost",
+                  [](SerialAudio &a) { a.queryVolume(); });
+            abandonedQuery();
+            // Poll the status in the background, and make sure a command
+            // doesn't have to wait for it.
+            m_audio.addBackgroundQuery(SerialAudio::Parameter::STATUS, 250);
+            runUntil([] { return false; }, 1010);
+            command("playTrack(1, 1) while polling",
+                    [](SerialAudio &a) { a.playTrack(1, 1); },
+                    [](ModuleEmulator &m) { return m.playing() && m.currentFile() == 1; });
+            m_audio.clearBackgroundQueries();
+            auto shuffled = SerialAudio::Playlist::fileRange(1, 8);
+            shuffled.setShuffle(true);
+            playlist("shuffled playlist", shuffled, false, 0x1FEul);
+            // Folder 2 holds files 21 through 40.
+            playlist("playOnModule(folder 2, 1-6)",
+                     SerialAudio::Playlist::folder(2, 1, 6), true,
+                     0x3Ful << 21);
+            printf("  mirror: volume %u%s, state %u%s (module: %u, %s)\n",
+                   m_audio.volume(),
+                   m_audio.isStale(SerialAudio::Parameter::VOLUME) ? "?" : "",
+                   static_cast<unsigned>(m_audio.moduleState()),
+                   m_audio.isStale(SerialAudio::Parameter::STATUS) ? "?" : "",
+                   m_module.volume(), m_module.playing() ? "playing" : "idle");
+            m_hooks.clear();
+            m_module.powerOn();
+            report("unexpected reset recovery",
+                   runUntil([this] { return m_hooks.initialized(); }));
+            printf("  frames: %u sent to module, %u received from module, "
+                   "%u dropped, %u bytes overrun\n",
+                   static_cast<unsigned>(m_module.framesReceived()),
+                   static_cast<unsigned>(m_module.framesSent()),
+                   static_cast<unsigned>(m_audio.droppedFrames()),
+                   static_cast<unsigned>(m_module.bytesOverrun()));
+#if AIDTOPIA_SERIALAUDIO_STATS
+            printStats();
+#endif
+            printf("\n");
+        }
+
+    private:
+        ModuleEmulator  m_module;
+        EmulatedBusyLine m_busyLine;
+        SerialAudio     m_audio;
+        RecordingHooks  m_hooks;
+        bool            m_deferred;
+};
+
+// Starts the library after the module has already announced itself, so it
+// has to discover the devices on its own.  Then, if the sketch expects one, a
+// USB drive is plugged in.
+void discovery(ModuleProfile const &profile, char const *what,
+               SerialAudio::Devices expected) {
+    ModuleEmulator module(profile);
+    module.insertDevice(0x02, Media{10, 20, 50, 5});
+    module.powerOn();
+    ::host::advanceMillis(3000);
+    while (module.read() >= 0) {}  // the INITCOMPLETE nobody heard
+    SerialAudio audio;
+    RecordingHooks hooks;
+    audio.setExpectedDevices(expected);
+    audio.begin(module);
+    auto const runUntil = [&](std::function<bool()> done) -> long {
+        auto const start = micros();
+        while (micros() - start < 10000000u) {
+            audio.update(hooks);
+            if (done()) return (micros() - start + 500u) / 1000u;
+            ::host::advanceMicros(100);
+        }
+        return -1;
+    };
+    printf("%s (late start, %s)\n", profile.name, what);
+    auto const init = runUntil([&] { return hooks.initialized(); });
+    printf("  %-28s %5ld ms\n", "begin to init complete", init);
+    if (!expected.has(SerialAudio::Device::USB)) {
+        printf("\n");
+        return;
+    }
+    runUntil([&] {
+        return audio.variant() != SerialAudio::Variant::UNKNOWN;
+    });
+    module.insertDevice(0x01, Media{2, 10, 0, 0});
+    auto const found = runUntil([&] {
+        return audio.availableDevices().has(SerialAudio::Device::USB);
+    });
+    printf("  %-28s %5ld ms\n", "USB inserted to available", found);
+    printf("\n");
+}
+
+}
+
+int main() {
+    ::host::useManualClock();
+    ModuleProfile const *profiles[] = {
+        &aidtopia::host::DFPLAYER_MINI,
+        &aidtopia::host::CATALEX,
+        &aidtopia::host::GENERIC_CLONE
+    };
+    for (auto const *profile : profiles) {
+        Bench bench(*profile);
+        bench.run();
+    }
+    Bench deferred(aidtopia::host::DFPLAYER_MINI, true);
+    deferred.run();
+
+#if AIDTOPIA_SERIALAUDIO_BUSY
+    Bench busy(aidtopia::host::DFPLAYER_MINI);
+    busy.busyLine();
+#endif
+
+    Bench cued(aidtopia::host::DFPLAYER_MINI);
+    cued.cue();
+
+    Bench ticketed(aidtopia::host::DFPLAYER_MINI);
+    ticketed.tickets();
+
+    using Device = SerialAudio::Device;
+    discovery(aidtopia::host::CATALEX, "expecting any device",
+              Device::USB | Device::SDCARD | Device::FLASH);
+    discovery(aidtopia::host::CATALEX, "expecting SD only", Device::SDCARD);
+    discovery(aidtopia::host::DFPLAYER_MINI, "expecting USB or SD",
+              Device::USB | Device::SDCARD);
+
+    MemoryStorage storage;
+    for (auto const *label : {"cold", "warm"}) {
+        FolderIndex index(&storage);
+        Bench bench(aidtopia::host::DFPLAYER_MINI, false, &index);
+        bench.mapFolders(label);
+    }
+    return 0;
+}
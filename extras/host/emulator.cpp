@@ -0,0 +1,710 @@
+#include "emulator.h"
+
+namespace aidtopia {
+namespace host {
+
+using ID = Message::ID;
+
+// Timing and quirks gleaned from extras/serial_audio_players.md.
+ModuleProfile const DFPLAYER_MINI = {
+    "DFPlayer Mini",
+    /* ackLatency */             6,
+    /* responseLatency */       20,
+    /* fileCountLatency */      60,
+    /* fileCountPerHundred */   15,
+    /* initLatency */         1500,
+    /* duplicateFinishedGap */  30,
+    /* firmwareVersion */        8,
+    /* currentFlashFile */       0,
+    /* maxVolume */             30,
+    /* defaultVolume */         25,
+    /* reportsZeroVolumeUntilSet */ false,
+    /* doubleAcksLoopFolder */   true,
+    /* supportsMp3Folder */      true,
+    /* supportsAdvert */         true,
+    /* supportsWake */           true,
+    /* supportsCombinedPlay */   true
+};
+
+ModuleProfile const CATALEX = {
+    "Catalex",
+    /* ackLatency */             5,
+    /* responseLatency */       15,
+    /* fileCountLatency */     120,
+    /* fileCountPerHundred */   40,
+    /* initLatency */          600,
+    /* duplicateFinishedGap */   0,
+    /* firmwareVersion */        0,
+    /* currentFlashFile */     256,
+    /* maxVolume */              0,
+    /* defaultVolume */         30,
+    /* reportsZeroVolumeUntilSet */ true,
+    /* doubleAcksLoopFolder */   true,
+    /* supportsMp3Folder */      false,
+    /* supportsAdvert */         false,
+    /* supportsWake */           true,
+    /* supportsCombinedPlay */   true
+};
+
+ModuleProfile const GENERIC_CLONE = {
+    "Generic clone",
+    /* ackLatency */            15,
+    /* responseLatency */       35,
+    /* fileCountLatency */     150,
+    /* fileCountPerHundred */   60,
+    /* initLatency */         2500,
+    /* duplicateFinishedGap */  60,
+    /* firmwareVersion */        6,
+    /* currentFlashFile */       0,
+    /* maxVolume */             30,
+    /* defaultVolume */         20,
+    /* reportsZeroVolumeUntilSet */ false,
+    /* doubleAcksLoopFolder */   true,
+    /* supportsMp3Folder */      true,
+    /* supportsAdvert */         true,
+    /* supportsWake */           false,
+    /* supportsCombinedPlay */   false
+};
+
+namespace {
+
+constexpr uint8_t USB   = 0x01;
+constexpr uint8_t SD    = 0x02;
+constexpr uint8_t FLASH = 0x04;
+constexpr uint8_t SLEEP = 0x10;
+
+enum ErrorCode : uint16_t {
+    UNSUPPORTED     = 0x00,
+    NOSOURCES       = 0x01,
+    SLEEPING        = 0x02,
+    BADCHECKSUM     = 0x04,
+    FILEOUTOFRANGE  = 0x05,
+    TRACKNOTFOUND   = 0x06,
+    INSERTIONERROR  = 0x07
+};
+
+constexpr uint32_t ms(uint32_t milliseconds) { return 1000u * milliseconds; }
+
+uint8_t slot(uint8_t device) {
+    switch (device) {
+        case USB:   return 0;
+        case FLASH: return 2;
+        default:    return 1;
+    }
+}
+
+}
+
+ModuleEmulator::ModuleEmulator(ModuleProfile const &profile) :
+    m_profile(profile),
+    m_byteTime(10000000u / 9600u),
+    m_inboundLineFree(micros()),
+    m_outboundLineFree(micros()),
+    m_media{},
+    m_devices(0),
+    m_selected(0),
+    m_initialized(false),
+    m_asleep(false),
+    m_state(STOPPED),
+    m_sequence(LOOPALL),
+    m_volume(profile.defaultVolume),
+    m_volumeSet(false),
+    m_eq(0),
+    m_file(0),
+    m_trackLength(3000),
+    m_advertLength(1000),
+    m_trackEnd(0),
+    m_remaining(0),
+    m_advertEnd(0),
+    m_quietUntil(micros()),
+    m_loopFolder(0),
+    m_generation(0),
+    m_random(12345),
+    m_framesReceived(0),
+    m_framesSent(0),
+    m_overrun(0) {}
+
+void ModuleEmulator::begin(unsigned long baudrate) {
+    // Each byte is a start bit, eight data bits, and a stop bit.
+    m_byteTime = static_cast<uint32_t>(10000000u / baudrate);
+}
+
+void ModuleEmulator::insertDevice(uint8_t device, Media const &media) {
+    m_media[slot(device)] = media;
+    if ((m_devices & device) != 0) return;
+    m_devices |= device;
+    if (m_initialized) {
+        service();
+        transmit(micros(), ID::DEVICEINSERTED, device);
+    }
+}
+
+void ModuleEmulator::removeDevice(uint8_t device) {
+    if ((m_devices & device) == 0) return;
+    m_devices &= ~device;
+    if (!m_initialized) return;
+    service();
+    if (device == m_selected) {
+        stop();
+        m_selected = (m_devices & USB) ? USB : (m_devices & SD) ? SD :
+                     (m_devices & FLASH) ? FLASH : 0;
+    }
+    transmit(micros(), ID::DEVICEREMOVED, device);
+}
+
+void ModuleEmulator::powerOn() {
+    service();
+    m_rxBuffer.clear();
+    m_outbound.clear();
+    m_events.clear();
+    startInit(micros());
+}
+
+void ModuleEmulator::setTrackLength(uint32_t trackLength) {
+    m_trackLength = trackLength;
+}
+
+void ModuleEmulator::setAdvertLength(uint32_t advertLength) {
+    m_advertLength = advertLength;
+}
+
+size_t ModuleEmulator::write(uint8_t b) {
+    service();
+    if (m_jammed) return 0;
+    auto const now = micros();
+    auto const start = before(m_inboundLineFree, now) ? now : m_inboundLineFree;
+    m_inboundLineFree = start + m_byteTime;
+    m_inbound.push_back(TimedByte{m_inboundLineFree, b});
+    return 1;
+}
+
+// Models a HardwareSerial transmit buffer of the same size as the receive
+// buffer.  Bytes still waiting for their turn on the wire occupy the buffer.
+int ModuleEmulator::availableForWrite() {
+    service();
+    if (m_jammed) return 0;
+    auto const now = micros();
+    int waiting = 0;
+    for (auto const &b : m_inbound) {
+        if (before(now, b.time - m_byteTime)) ++waiting;
+    }
+    return waiting < RX_BUFFER_SIZE ? RX_BUFFER_SIZE - waiting : 0;
+}
+
+int ModuleEmulator::available() {
+    service();
+    return static_cast<int>(m_rxBuffer.size());
+}
+
+int ModuleEmulator::read() {
+    service();
+    if (m_rxBuffer.empty()) return -1;
+    auto const b = m_rxBuffer.front();
+    m_rxBuffer.pop_front();
+    return b;
+}
+
+int ModuleEmulator::peek() {
+    service();
+    return m_rxBuffer.empty() ? -1 : m_rxBuffer.front();
+}
+
+void ModuleEmulator::service() {
+    auto const now = micros();
+
+    // Process inbound bytes and scheduled events in chronological order, since
+    // either may change the state the other depends on.
+    for (;;) {
+        bool const haveByte =
+            !m_inbound.empty() && !before(now, m_inbound.front().time);
+        bool const haveEvent =
+            !m_events.empty() && !before(now, m_events.front().due);
+        if (haveByte &&
+            (!haveEvent || !before(m_events.front().due, m_inbound.front().time))
+        ) {
+            auto const b = m_inbound.front();
+            m_inbound.pop_front();
+            receiveByte(b);
+        } else if (haveEvent) {
+            auto const event = m_events.front();
+            m_events.erase(m_events.begin());
+            handle(event);
+        } else {
+            break;
+        }
+    }
+
+    // Move the bytes that have finished arriving into the receive buffer.
+    // Anything that arrives while the buffer is full is lost, just as it would
+    // be with a real UART.
+    while (!m_outbound.empty() && !before(now, m_outbound.front().time)) {
+        if (m_rxBuffer.size() < RX_BUFFER_SIZE) {
+            m_rxBuffer.push_back(m_outbound.front().value);
+        } else {
+            ++m_overrun;
+        }
+        m_outbound.pop_front();
+    }
+
+    // Times in the past are compared with wraparound in mind, so they must
+    // not fall more than half the range of micros() behind.
+    if (before(m_inboundLineFree, now)) m_inboundLineFree = now;
+    if (before(m_outboundLineFree, now)) m_outboundLineFree = now;
+    if (before(m_quietUntil, now)) m_quietUntil = now;
+}
+
+void ModuleEmulator::receiveByte(TimedByte const &b) {
+    if (m_parser.receive(b.value)) onFrame(b.time, m_parser);
+}
+
+void ModuleEmulator::onFrame(uint32_t t, MessageBuffer const &frame) {
+    ++m_framesReceived;
+    if (!m_initialized) return;  // too busy initializing to listen
+    if (!frame.isValid() || m_garble > 0) {
+        if (m_garble > 0) --m_garble;
+        error(t + ms(m_profile.ackLatency), BADCHECKSUM);
+        return;
+    }
+    auto const msg = Message{static_cast<ID>(frame.getID()), frame.getData()};
+    m_payload.assign(frame.getPayload(),
+                     frame.getPayload() + frame.getPayloadLength());
+    bool const feedback = frame.getBytes()[4] != 0;
+    if (isQuery(msg)) {
+        onQuery(t, msg);
+        // Queries with feedback get an ACK right after the response.
+        if (feedback) {
+            schedule(t + ms(m_profile.responseLatency) + 1, ID::ACK);
+        }
+        return;
+    }
+    onCommand(t, msg, feedback);
+}
+
+void ModuleEmulator::onCommand(uint32_t t, Message const &msg, bool feedback) {
+    auto const acked = t + ms(m_profile.ackLatency);
+    if (feedback) schedule(acked, ID::ACK);
+    // Errors follow the ACK.
+    auto const later = acked + ms(1);
+    auto const param = msg.getParam();
+    auto const hi = static_cast<uint8_t>(param >> 8);
+    auto const lo = static_cast<uint8_t>(param & 0xFF);
+
+    if (m_asleep) {
+        switch (msg.getID()) {
+            case ID::WAKE: case ID::SELECTSOURCE: case ID::RESET: break;
+            default: error(later, SLEEPING); return;
+        }
+    }
+
+    auto const &files = media();
+    switch (msg.getID()) {
+        case ID::PLAYNEXT:
+            if (!play(acked, nextFile(m_file), SINGLE)) error(later, NOSOURCES);
+            break;
+        case ID::PLAYPREVIOUS: {
+            auto const count = fileCount(m_selected);
+            auto const file = m_file > 1 ? m_file - 1 : count;
+            if (!play(acked, file, SINGLE)) error(later, NOSOURCES);
+            break;
+        }
+        case ID::PLAYFILE:
+            if (!play(acked, param, SINGLE)) error(later, FILEOUTOFRANGE);
+            break;
+        case ID::VOLUMEUP:
+            if (m_profile.maxVolume == 0 || m_volume < m_profile.maxVolume) {
+                ++m_volume;
+            }
+            m_volumeSet = true;
+            break;
+        case ID::VOLUMEDOWN:
+            if (m_volume > 0) --m_volume;
+            m_volumeSet = true;
+            break;
+        case ID::SETVOLUME:
+            m_volume = m_profile.maxVolume == 0 ? lo : min(lo, m_profile.maxVolume);
+            m_volumeSet = true;
+            break;
+        case ID::SETEQPROFILE:
+            if (param > 5) { error(later, UNSUPPORTED); break; }
+            m_eq = lo;
+            break;
+        case ID::LOOPFILE:
+            if (!play(acked, param, LOOPTRACK)) error(later, FILEOUTOFRANGE);
+            break;
+        case ID::SELECTSOURCE:
+            if (!online(lo)) { error(later, NOSOURCES); break; }
+            stop();
+            m_selected = lo;
+            m_asleep = false;
+            break;
+        case ID::SLEEP:
+            stop();
+            m_asleep = true;
+            break;
+        case ID::WAKE:
+            if (!m_profile.supportsWake) { error(later, UNSUPPORTED); break; }
+            m_asleep = false;
+            break;
+        case ID::RESET:
+            startInit(acked);
+            break;
+        case ID::RESUME:
+            if (m_state == PAUSED) resume(acked);
+            break;
+        case ID::PAUSE:
+            if (m_state == PLAYING) pause(acked);
+            break;
+        case ID::PLAYFROMFOLDER:
+            if (hi == 0 || hi > files.folders || lo == 0 ||
+                lo > files.filesPerFolder ||
+                !play(acked, (hi - 1) * files.filesPerFolder + lo, SINGLE)
+            ) {
+                error(later, TRACKNOTFOUND);
+            }
+            break;
+        case ID::PLAYLIST: {
+            if (!m_profile.supportsCombinedPlay) {
+                error(later, UNSUPPORTED);
+                break;
+            }
+            // Pairs of folder and track numbers
+            m_combined.clear();
+            for (size_t i = 0; i + 1 < m_payload.size(); i += 2) {
+                auto const folder = m_payload[i];
+                auto const track = m_payload[i + 1];
+                if (folder == 0 || folder > files.folders || track == 0 ||
+                    track > files.filesPerFolder) {
+                    m_combined.clear();
+                    break;
+                }
+                m_combined.push_back((folder - 1) * files.filesPerFolder + track);
+            }
+            if (m_combined.empty()) { error(later, TRACKNOTFOUND); break; }
+            auto const first = m_combined.front();
+            m_combined.pop_front();
+            if (!play(acked, first, COMBINED)) error(later, TRACKNOTFOUND);
+            break;
+        }
+        case ID::PLAYFROMBIGFOLDER: {
+            auto const folder = static_cast<uint8_t>(param >> 12);
+            auto const track = static_cast<uint16_t>(param & 0x0FFF);
+            if (folder == 0 || folder > files.folders || track == 0 ||
+                track > files.filesPerFolder ||
+                !play(acked, (folder - 1) * files.filesPerFolder + track, SINGLE)
+            ) {
+                error(later, TRACKNOTFOUND);
+            }
+            break;
+        }
+        case ID::PLAYFROMMP3: {
+            if (!m_profile.supportsMp3Folder) { error(later, UNSUPPORTED); break; }
+            auto const base = files.folders * files.filesPerFolder;
+            if (param == 0 || param > files.mp3Tracks ||
+                !play(acked, base + param, SINGLE)
+            ) {
+                error(later, TRACKNOTFOUND);
+            }
+            break;
+        }
+        case ID::INSERTADVERT:
+        case ID::INSERTADVERTN:
+            if (!m_profile.supportsAdvert) { error(later, UNSUPPORTED); break; }
+            if (m_state != PLAYING || m_advertEnd != 0 ||
+                lo == 0 || lo > files.advertTracks
+            ) {
+                error(later, INSERTIONERROR);
+                break;
+            }
+            pause(acked);
+            m_state = PLAYING;
+            m_advertEnd = acked + ms(m_advertLength);
+            schedule(m_advertEnd, Action::ADVERTEND, m_generation);
+            break;
+        case ID::STOPADVERT:
+            if (m_advertEnd != 0) {
+                m_advertEnd = 0;
+                resume(acked);
+            }
+            break;
+        case ID::STOP:
+            stop();
+            m_sequence = SINGLE;
+            break;
+        case ID::LOOPFOLDER:
+            if (param == 0 || param > files.folders) {
+                error(later, TRACKNOTFOUND);
+                break;
+            }
+            m_loopFolder = lo;
+            play(acked + ms(m_profile.ackLatency),
+                 (lo - 1) * files.filesPerFolder + 1, LOOPFOLDER);
+            if (feedback && m_profile.doubleAcksLoopFolder) {
+                schedule(acked + ms(m_profile.ackLatency), ID::ACK);
+            }
+            break;
+        case ID::LOOPALL:
+            if (param == 2) { m_sequence = SINGLE; break; }
+            if (!play(acked, 1, LOOPALL)) error(later, NOSOURCES);
+            break;
+        case ID::RANDOMPLAY:
+            m_random = m_random * 1103515245u + 12345u;
+            if (!play(acked, 1 + (m_random >> 16) % max(fileCount(m_selected), 1),
+                      RANDOM)
+            ) {
+                error(later, NOSOURCES);
+            }
+            break;
+        case ID::LOOPCURRENTTRACK:
+            if (m_state != PLAYING) { error(later, UNSUPPORTED); break; }
+            m_sequence = param == 0 ? LOOPTRACK : SINGLE;
+            break;
+        case ID::DISABLEDAC:
+            break;
+        case ID::PLAYWITHVOLUME:
+            m_volume = m_profile.maxVolume == 0 ? hi : min(hi, m_profile.maxVolume);
+            m_volumeSet = true;
+            if (!play(acked, lo, SINGLE)) error(later, FILEOUTOFRANGE);
+            break;
+        default:
+            error(later, UNSUPPORTED);
+            break;
+    }
+}
+
+void ModuleEmulator::onQuery(uint32_t t, Message const &msg) {
+    auto const responds = t + ms(m_profile.responseLatency);
+    switch (msg.getID()) {
+        case ID::STATUS: {
+            uint8_t const device = m_asleep ? SLEEP : m_selected;
+            schedule(responds, ID::STATUS, (device << 8) | m_state);
+            break;
+        }
+        case ID::VOLUME:
+            schedule(responds, ID::VOLUME,
+                     m_profile.reportsZeroVolumeUntilSet && !m_volumeSet ?
+                        0 : m_volume);
+            break;
+        case ID::EQPROFILE:
+            schedule(responds, ID::EQPROFILE, m_eq);
+            break;
+        case ID::PLAYBACKSEQUENCE:
+            schedule(responds, ID::PLAYBACKSEQUENCE, m_sequence);
+            break;
+        case ID::FIRMWAREVERSION:
+            if (m_profile.firmwareVersion == 0) break;
+            schedule(responds, ID::FIRMWAREVERSION, m_profile.firmwareVersion);
+            break;
+        case ID::USBFILECOUNT:
+        case ID::SDFILECOUNT:
+        case ID::FLASHFILECOUNT: {
+            uint8_t const device =
+                msg.getID() == ID::USBFILECOUNT ? USB :
+                msg.getID() == ID::SDFILECOUNT  ? SD  : FLASH;
+            auto const count = fileCount(device);
+            auto const delay = m_profile.fileCountLatency +
+                               m_profile.fileCountPerHundred * count / 100u;
+            schedule(t + ms(delay), msg.getID(), count);
+            break;
+        }
+        case ID::CURRENTUSBFILE:
+            schedule(responds, msg.getID(), m_selected == USB ? m_file : 0);
+            break;
+        case ID::CURRENTSDFILE:
+            schedule(responds, msg.getID(), m_selected == SD ? m_file : 0);
+            break;
+        case ID::CURRENTFLASHFILE:
+            schedule(responds, msg.getID(),
+                     m_profile.currentFlashFile != 0 ? m_profile.currentFlashFile :
+                     m_selected == FLASH ? m_file : 0);
+            break;
+        case ID::FOLDERFILECOUNT: {
+            auto const &files = media();
+            auto const folder = msg.getParam();
+            auto const delay = m_profile.fileCountLatency +
+                               m_profile.fileCountPerHundred *
+                               files.filesPerFolder / 100u;
+            if (folder == 0 || folder > files.folders) {
+                error(t + ms(delay), TRACKNOTFOUND);
+                break;
+            }
+            schedule(t + ms(delay), ID::FOLDERFILECOUNT, files.filesPerFolder);
+            break;
+        }
+        case ID::FOLDERCOUNT: {
+            auto const &files = media();
+            schedule(responds, ID::FOLDERCOUNT,
+                     files.folders + (files.mp3Tracks != 0 ? 1 : 0) +
+                                     (files.advertTracks != 0 ? 1 : 0));
+            break;
+        }
+        case ID::INITCOMPLETE:
+            // Documented as a query, but none of the modules answer it.
+            break;
+        default:
+            error(responds, UNSUPPORTED);
+            break;
+    }
+}
+
+void ModuleEmulator::handle(Event const &event) {
+    switch (event.action) {
+        case Action::FRAME:
+            transmit(event.due, event.msgid, event.param);
+            break;
+        case Action::INIT: {
+            if (event.generation != m_generation) break;
+            m_initialized = true;
+            if (m_devices == 0) {
+                transmit(event.due, ID::ERROR, NOSOURCES);
+                break;
+            }
+            m_selected = (m_devices & USB) ? USB : (m_devices & SD) ? SD : FLASH;
+            // When both a USB drive and an SD card are present, INITCOMPLETE
+            // mentions only the USB drive.
+            uint8_t devices = m_devices;
+            if (devices & USB) devices &= ~SD;
+            transmit(event.due, ID::INITCOMPLETE, devices);
+            break;
+        }
+        case Action::TRACKEND: {
+            if (event.generation != m_generation || m_state != PLAYING) break;
+            auto const finished =
+                m_selected == USB   ? ID::FINISHEDUSBFILE :
+                m_selected == FLASH ? ID::FINISHEDFLASHFILE :
+                                      ID::FINISHEDSDFILE;
+            transmit(event.due, finished, m_file);
+            if (m_profile.duplicateFinishedGap != 0) {
+                schedule(event.due + ms(m_profile.duplicateFinishedGap),
+                         finished, m_file);
+            }
+            auto const &files = media();
+            switch (m_sequence) {
+                case LOOPTRACK: play(event.due, m_file, LOOPTRACK); break;
+                case LOOPALL:   play(event.due, nextFile(m_file), LOOPALL); break;
+                case LOOPFOLDER: {
+                    auto const first = (m_loopFolder - 1) * files.filesPerFolder + 1;
+                    auto const last = first + files.filesPerFolder - 1;
+                    play(event.due, m_file < last ? m_file + 1 : first, LOOPFOLDER);
+                    break;
+                }
+                case RANDOM:
+                    m_random = m_random * 1103515245u + 12345u;
+                    play(event.due,
+                         1 + (m_random >> 16) % max(fileCount(m_selected), 1),
+                         RANDOM);
+                    break;
+                case COMBINED:
+                    if (m_combined.empty()) { stop(); break; }
+                    play(event.due, m_combined.front(), COMBINED);
+                    m_combined.pop_front();
+                    break;
+                default:
+                    stop();
+                    break;
+            }
+            break;
+        }
+        case Action::ADVERTEND:
+            if (event.generation != m_generation || m_advertEnd == 0) break;
+            m_advertEnd = 0;
+            // The module takes a moment to switch back.
+            m_quietUntil = event.due + ms(20);
+            resume(m_quietUntil);
+            break;
+    }
+}
+
+void ModuleEmulator::schedule(uint32_t due, Message::ID msgid, uint16_t param) {
+    auto event = Event{due, Action::FRAME, msgid, param, 0};
+    auto it = m_events.begin();
+    while (it != m_events.end() && !before(due, it->due)) ++it;
+    m_events.insert(it, event);
+}
+
+void ModuleEmulator::schedule(uint32_t due, Action action, uint32_t generation) {
+    auto event = Event{due, action, ID::NONE, 0, generation};
+    auto it = m_events.begin();
+    while (it != m_events.end() && !before(due, it->due)) ++it;
+    m_events.insert(it, event);
+}
+
+void ModuleEmulator::transmit(uint32_t start, Message::ID msgid, uint16_t param) {
+    if (m_lose > 0) { --m_lose; return; }
+    auto const frame =
+        MessageBuffer(static_cast<uint8_t>(msgid), param, false);
+    auto t = before(m_outboundLineFree, start) ? start : m_outboundLineFree;
+    auto const bytes = frame.getBytes();
+    for (uint8_t i = 0; i < frame.getLength(); ++i) {
+        t += m_byteTime;
+        m_outbound.push_back(TimedByte{t, bytes[i]});
+    }
+    m_outboundLineFree = t;
+    ++m_framesSent;
+}
+
+void ModuleEmulator::error(uint32_t t, uint16_t code) {
+    schedule(t, ID::ERROR, code);
+}
+
+bool ModuleEmulator::online(uint8_t device) const {
+    return device != 0 && (m_devices & device) == device;
+}
+
+Media const &ModuleEmulator::media() const {
+    return m_media[slot(m_selected)];
+}
+
+uint16_t ModuleEmulator::fileCount(uint8_t device) const {
+    return online(device) ? m_media[slot(device)].fileCount() : 0;
+}
+
+bool ModuleEmulator::play(uint32_t t, uint16_t file, Sequence sequence) {
+    if (!online(m_selected)) return false;
+    if (file == 0 || file > fileCount(m_selected)) return false;
+    m_file = file;
+    m_state = PLAYING;
+    m_sequence = sequence;
+    m_advertEnd = 0;
+    m_trackEnd = t + ms(m_trackLength);
+    schedule(m_trackEnd, Action::TRACKEND, ++m_generation);
+    return true;
+}
+
+void ModuleEmulator::stop() {
+    m_state = STOPPED;
+    m_advertEnd = 0;
+    ++m_generation;
+}
+
+void ModuleEmulator::pause(uint32_t t) {
+    m_remaining = before(t, m_trackEnd) ? m_trackEnd - t : 0;
+    m_state = PAUSED;
+    ++m_generation;
+}
+
+void ModuleEmulator::resume(uint32_t t) {
+    m_state = PLAYING;
+    m_trackEnd = t + m_remaining;
+    schedule(m_trackEnd, Action::TRACKEND, ++m_generation);
+}
+
+void ModuleEmulator::startInit(uint32_t t) {
+    m_initialized = false;
+    m_asleep = false;
+    m_state = STOPPED;
+    m_sequence = LOOPALL;
+    m_volume = m_profile.defaultVolume;
+    m_volumeSet = false;
+    m_eq = 0;
+    m_file = 0;
+    m_advertEnd = 0;
+    schedule(t + ms(m_profile.initLatency), Action::INIT, ++m_generation);
+}
+
+uint16_t ModuleEmulator::nextFile(uint16_t file) const {
+    auto const count = fileCount(m_selected);
+    return file < count ? file + 1 : 1;
+}
+
+}
+}
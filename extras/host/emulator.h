@@ -0,0 +1,248 @@
+// Serial audio module emulator
+// Adrian McCarthy 2018-
+
+// ModuleEmulator is a host-side stand-in for a serial audio module.  It's a
+// `Stream`, so it can be handed to `SerialAudio::begin` in place of a serial
+// port.  It decodes the frames the library sends, models enough of the
+// module's state to answer them, and sends back ACKs, query responses, errors,
+// and notifications with byte-accurate serial timing.
+//
+// Each ModuleProfile captures the timing and quirks of a particular model, as
+// described in extras/serial_audio_players.md.  The latencies in the built-in
+// profiles are representative rather than authoritative.  Adjust them to match
+// the module you care about.
+//
+// The emulator does nothing on its own.  It catches up to the current time
+// (as reported by `micros`) whenever the library touches the stream, so a
+// simulation can use the manual clock in Arduino.h to run faster than real
+// time.
+
+#ifndef AIDTOPIA_HOST_EMULATOR_H
+#define AIDTOPIA_HOST_EMULATOR_H
+
+#include <Arduino.h>
+#include <deque>
+#include <vector>
+#include "utilities/busy.h"
+#include "utilities/message.h"
+#include "utilities/messagebuffer.h"
+
+namespace aidtopia {
+namespace host {
+
+struct ModuleProfile {
+    char const *name;
+
+    // Times in milliseconds, measured from the end of the last byte of the
+    // incoming frame.
+    uint16_t ackLatency;
+    uint16_t responseLatency;
+    uint16_t fileCountLatency;      // for *FILECOUNT and FOLDERFILECOUNT
+    uint16_t fileCountPerHundred;   // additional time per 100 files
+    uint16_t initLatency;           // power-up or reset to INITCOMPLETE
+
+    // The gap between duplicate FINISHED*FILE notifications.  Zero means the
+    // module sends only one.
+    uint16_t duplicateFinishedGap;
+
+    uint16_t firmwareVersion;       // 0 means the query goes unanswered
+    uint16_t currentFlashFile;      // nonzero means always report this value
+    uint8_t  maxVolume;             // 0 means volume isn't clamped (Catalex)
+    uint8_t  defaultVolume;
+    bool     reportsZeroVolumeUntilSet;
+    bool     doubleAcksLoopFolder;
+    bool     supportsMp3Folder;
+    bool     supportsAdvert;
+    bool     supportsWake;
+    bool     supportsCombinedPlay;  // the 0x21 playlist command
+};
+
+extern ModuleProfile const DFPLAYER_MINI;
+extern ModuleProfile const CATALEX;
+extern ModuleProfile const GENERIC_CLONE;
+
+// Describes the audio files on a storage device.  Files are numbered with the
+// numbered folders first, then the "MP3" folder, and then the "ADVERT" folder.
+struct Media {
+    uint8_t  folders;           // numbered folders "01" through "nn"
+    uint16_t filesPerFolder;
+    uint16_t mp3Tracks;
+    uint16_t advertTracks;
+
+    uint16_t fileCount() const {
+        return folders * filesPerFolder + mp3Tracks + advertTracks;
+    }
+};
+
+class ModuleEmulator : public Stream {
+    public:
+        explicit ModuleEmulator(ModuleProfile const &profile);
+
+        // Called by `SerialAudioCore::begin`.
+        void begin(unsigned long baudrate);
+
+        // Storage devices.  Changes while the module is running produce
+        // DEVICEINSERTED and DEVICEREMOVED notifications.
+        // `device` is 0x01 for USB, 0x02 for SD card, or 0x04 for Flash.
+        void insertDevice(uint8_t device, Media const &media);
+        void removeDevice(uint8_t device);
+
+        // Simulates applying power.  The module sends INITCOMPLETE (or an
+        // error if there are no devices) after the profile's init latency.
+        void powerOn();
+
+        // How long each track plays, in milliseconds.
+        void setTrackLength(uint32_t trackLength);
+        void setAdvertLength(uint32_t advertLength);
+
+        // Line noise.  The module sees the next `frames` incoming frames as
+        // garbled (and answers with BADCHECKSUM), or the next `frames`
+        // outgoing ones never arrive.
+        void garbleIncoming(uint8_t frames) { m_garble = frames; }
+        void loseOutgoing(uint8_t frames) { m_lose = frames; }
+        // An error out of the blue, as a module sends when noise on the line
+        // looks like the start of a frame.
+        void sendError(uint16_t code) { error(micros(), code); }
+        // The controller's transmitter stops taking bytes (or starts again),
+        // as when a port is wedged.
+        void jamTransmitter(bool jammed) { m_jammed = jammed; }
+
+        // Stream interface
+        using Print::write;
+        size_t write(uint8_t b) override;
+        int availableForWrite() override;
+        int available() override;
+        int read() override;
+        int peek() override;
+
+        // Catches up on everything that should have happened by now.  The
+        // Stream methods call this, so it's rarely necessary to call it
+        // directly.
+        void service();
+
+        // Introspection for simulations
+        ModuleProfile const &profile() const { return m_profile; }
+        bool     playing() const { return m_state == PLAYING; }
+        bool     playingAdvert() const { return m_advertEnd != 0; }
+        // The BUSY output.  It goes idle briefly when an advert ends, before
+        // the interrupted track resumes.
+        bool     busy() const {
+            return m_state == PLAYING && !before(micros(), m_quietUntil);
+        }
+        uint16_t currentFile() const { return m_file; }
+        uint8_t  volume() const { return m_volume; }
+        uint32_t framesReceived() const { return m_framesReceived; }
+        uint32_t framesSent() const { return m_framesSent; }
+        uint32_t bytesOverrun() const { return m_overrun; }
+
+        // The controller's receive buffer, like a HardwareSerial's.
+        static constexpr int RX_BUFFER_SIZE = 64;
+
+    private:
+        enum PlayState : uint8_t { STOPPED = 0, PLAYING = 1, PAUSED = 2 };
+        enum Sequence : uint8_t {
+            LOOPALL = 0, LOOPFOLDER = 1, LOOPTRACK = 2, RANDOM = 3, SINGLE = 4,
+            COMBINED = 5  // not a real sequence; plays m_combined in order
+        };
+
+        struct TimedByte { uint32_t time; uint8_t value; };
+
+        enum class Action : uint8_t { FRAME, INIT, TRACKEND, ADVERTEND };
+        struct Event {
+            uint32_t   due;
+            Action     action;
+            Message::ID msgid;
+            uint16_t   param;
+            uint32_t   generation;
+        };
+
+        static bool before(uint32_t a, uint32_t b) {
+            return static_cast<int32_t>(a - b) < 0;
+        }
+
+        void receiveByte(TimedByte const &b);
+        void onFrame(uint32_t t, MessageBuffer const &frame);
+        void onCommand(uint32_t t, Message const &msg, bool feedback);
+        void onQuery(uint32_t t, Message const &msg);
+        void handle(Event const &event);
+
+        void schedule(uint32_t due, Message::ID msgid, uint16_t param = 0);
+        void schedule(uint32_t due, Action action, uint32_t generation = 0);
+        void transmit(uint32_t start, Message::ID msgid, uint16_t param);
+        void error(uint32_t t, uint16_t code);
+
+        bool online(uint8_t device) const;
+        Media const &media() const;
+        uint16_t fileCount(uint8_t device) const;
+        bool play(uint32_t t, uint16_t file, Sequence sequence);
+        void stop();
+        void pause(uint32_t t);
+        void resume(uint32_t t);
+        void startInit(uint32_t t);
+        uint16_t nextFile(uint16_t file) const;
+
+        ModuleProfile m_profile;
+        uint32_t      m_byteTime;       // microseconds per byte on the wire
+
+        // Controller -> module
+        std::deque<TimedByte> m_inbound;
+        uint32_t              m_inboundLineFree;
+        MessageBuffer         m_parser;
+        std::vector<uint8_t>  m_payload;  // data bytes of the current frame
+
+        // Module -> controller
+        std::vector<Event>    m_events;  // sorted by due time
+        std::deque<TimedByte> m_outbound;
+        uint32_t              m_outboundLineFree;
+        std::deque<uint8_t>   m_rxBuffer;  // arrived but not yet read
+
+        // Module state
+        Media     m_media[3];           // USB, SD, Flash
+        uint8_t   m_devices;            // bitmask of online devices
+        uint8_t   m_selected;
+        bool      m_initialized;
+        bool      m_asleep;
+        PlayState m_state;
+        Sequence  m_sequence;
+        uint8_t   m_volume;
+        bool      m_volumeSet;
+        uint8_t   m_eq;
+        uint16_t  m_file;
+        uint32_t  m_trackLength;
+        uint32_t  m_advertLength;
+        uint32_t  m_trackEnd;
+        uint32_t  m_remaining;
+        uint32_t  m_advertEnd;
+        uint32_t  m_quietUntil;         // BUSY is idle until then
+        uint8_t   m_loopFolder;
+        uint32_t  m_generation;
+        uint32_t  m_random;
+        std::deque<uint16_t> m_combined;  // the rest of a combined play
+
+        uint8_t   m_garble = 0;
+        uint8_t   m_lose = 0;
+        bool      m_jammed = false;
+
+        uint32_t  m_framesReceived;
+        uint32_t  m_framesSent;
+        uint32_t  m_overrun;
+};
+
+// Lets SerialAudio read the emulated module's BUSY output.
+class EmulatedBusyLine : public BusySource {
+    public:
+        explicit EmulatedBusyLine(ModuleEmulator &module) : m_module(module) {}
+
+        bool busy() override {
+            m_module.service();
+            return m_module.busy();
+        }
+
+    private:
+        ModuleEmulator &m_module;
+};
+
+}
+}
+
+#endif
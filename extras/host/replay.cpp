@@ -0,0 +1,334 @@
+// Replays a trace recorded with `SerialAudio::useTrace` through the library on
+// the desktop.  The frames the module sent are fed back at the times they were
+// received, the sketch's requests are made again at the times they were made,
+// and the frames the library sends are compared with the ones in the trace.
+// A mismatch means the library (perhaps a newer version of it) would have
+// behaved differently in the recorded session.
+//
+//     ./replay trace.bin
+//
+// The trace can be a raw capture of the serial monitor:  anything before the
+// "SAT1" signature is skipped.
+//
+// The replay is only exact when the trace begins at `SerialAudio::begin` (that
+// is, the ring buffer never wrapped) and the sketch used the default settings.
+// Settings like `setRetryPolicy` or `disableFeedback` aren't in the trace, nor
+// is the BUSY line, so sessions that relied on them will drift.  A playlist
+// handed to `playOnModule` can't be rebuilt from the trace, so it's skipped.
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <deque>
+#include <vector>
+#include "AidtopiaSerialAudio.h"
+#include "utilities/messagebuffer.h"
+#include "utilities/trace.h"
+
+using aidtopia::Message;
+using aidtopia::MessageBuffer;
+using aidtopia::SerialAudio;
+using aidtopia::TraceRecord;
+
+namespace {
+
+using ID = Message::ID;
+
+struct Frame {
+    uint32_t time;
+    uint8_t  msgid;
+    uint16_t param;
+    bool     feedback;
+};
+
+// Stands in for the serial port.  Incoming bytes are queued by the replay;
+// outgoing bytes are parsed back into frames for comparison.
+class ReplayStream : public Stream {
+    public:
+        void begin(unsigned long /*baudrate*/) {}
+
+        void deliver(uint8_t const *bytes, uint8_t length) {
+            m_in.insert(m_in.end(), bytes, bytes + length);
+        }
+
+        std::deque<Frame> &sent() { return m_sent; }
+
+        using Print::write;
+        size_t write(uint8_t b) override {
+            if (m_out.receive(b) && m_out.isValid()) {
+                m_sent.push_back(Frame{micros(), m_out.getID(), m_out.getData(),
+                                       m_out.getBytes()[4] != 0});
+            }
+            return 1;
+        }
+        int availableForWrite() override { return 64; }
+        int available() override { return static_cast<int>(m_in.size()); }
+        int read() override {
+            if (m_in.empty()) return -1;
+            auto const b = m_in.front();
+            m_in.pop_front();
+            return b;
+        }
+        int peek() override { return m_in.empty() ? -1 : m_in.front(); }
+
+    private:
+        std::deque<uint8_t> m_in;
+        MessageBuffer       m_out;
+        std::deque<Frame>   m_sent;
+};
+
+class PrintingHooks : public SerialAudio::Hooks {
+    public:
+        explicit PrintingHooks(uint32_t const &origin) : m_origin(origin) {}
+
+    private:
+        void onError(Error code, ID msgid) override {
+            stamp(); printf("error 0x%02X for 0x%02X\n",
+                            static_cast<unsigned>(code),
+                            static_cast<unsigned>(msgid));
+        }
+        void onQueryResponse(Parameter param, uint16_t value) override {
+            stamp(); printf("response 0x%02X = %u\n",
+                            static_cast<unsigned>(param), value);
+        }
+        void onDeviceChange(Device src, DeviceChange change) override {
+            stamp(); printf("device 0x%02X %s\n", static_cast<unsigned>(src),
+                            change == DeviceChange::INSERTED ? "inserted"
+                                                             : "removed");
+        }
+        void onFinishedFile(Device, uint16_t index) override {
+            stamp(); printf("finished file %u\n", index);
+        }
+        void onInitComplete(Devices devices) override {
+            stamp(); printf("init complete, devices 0x%02X\n",
+                            devices.bitmask());
+        }
+
+        void stamp() const {
+            printf("%10.3f          event      ", (micros() - m_origin) / 1000.0);
+        }
+
+        uint32_t const &m_origin;
+};
+
+// Makes the public call that would have produced the request.  Returns false
+// if there isn't one.
+bool request(SerialAudio &audio, uint8_t msgid, uint16_t param) {
+    auto const hi = static_cast<uint8_t>(param >> 8);
+    auto const lo = static_cast<uint8_t>(param & 0xFF);
+    switch (static_cast<ID>(msgid)) {
+        case ID::PLAYNEXT:          audio.playNextFile();               break;
+        case ID::PLAYPREVIOUS:      audio.playPreviousFile();           break;
+        case ID::PLAYFILE:          audio.playFile(param);              break;
+        case ID::VOLUMEUP:          audio.increaseVolume();             break;
+        case ID::VOLUMEDOWN:        audio.decreaseVolume();             break;
+        case ID::SETVOLUME:         audio.setVolume(lo);                break;
+        case ID::SETEQPROFILE:
+            audio.setEqProfile(static_cast<SerialAudio::EqProfile>(lo));
+            break;
+        case ID::LOOPFILE:          audio.loopFile(param);              break;
+        case ID::SELECTSOURCE:
+            audio.selectSource(static_cast<SerialAudio::Device>(lo));
+            break;
+        case ID::UNPAUSE:           audio.unpause();                    break;
+        case ID::PAUSE:             audio.pause();                      break;
+        case ID::PLAYFROMFOLDER:    audio.playTrack(hi, lo);            break;
+        case ID::LOOPALL:           audio.loopAllFiles();               break;
+        case ID::PLAYFROMMP3:       audio.playTrack(param);             break;
+        case ID::INSERTADVERT:      audio.insertAdvert(param);          break;
+        case ID::PLAYFROMBIGFOLDER:
+            audio.playTrack(param >> 12, param & 0x0FFF);
+            break;
+        case ID::STOPADVERT:        audio.stopAdvert();                 break;
+        case ID::STOP:              audio.stop();                       break;
+        case ID::LOOPFOLDER:        audio.loopFolder(param);            break;
+        case ID::RANDOMPLAY:        audio.playFilesInRandomOrder();     break;
+        case ID::LOOPCURRENTTRACK:
+            if (param == 0) audio.loopCurrentTrack();
+            else            audio.stopLoopingCurrentTrack();
+            break;
+        case ID::INSERTADVERTN:     audio.insertAdvert(hi, lo);         break;
+        case ID::STATUS:            audio.queryStatus();                break;
+        case ID::VOLUME:            audio.queryVolume();                break;
+        case ID::EQPROFILE:         audio.queryEqProfile();             break;
+        case ID::PLAYBACKSEQUENCE:  audio.queryPlaybackSequence();      break;
+        case ID::FIRMWAREVERSION:   audio.queryFirmwareVersion();       break;
+        case ID::USBFILECOUNT:
+            audio.queryFileCount(SerialAudio::Device::USB);
+            break;
+        case ID::SDFILECOUNT:
+            audio.queryFileCount(SerialAudio::Device::SDCARD);
+            break;
+        case ID::FLASHFILECOUNT:
+            audio.queryFileCount(SerialAudio::Device::FLASH);
+            break;
+        case ID::CURRENTUSBFILE:
+            audio.queryCurrentFile(SerialAudio::Device::USB);
+            break;
+        case ID::CURRENTSDFILE:
+            audio.queryCurrentFile(SerialAudio::Device::SDCARD);
+            break;
+        case ID::CURRENTFLASHFILE:
+            audio.queryCurrentFile(SerialAudio::Device::FLASH);
+            break;
+        case ID::FOLDERFILECOUNT:   audio.queryFolderFileCount(param);  break;
+        case ID::FOLDERCOUNT:       audio.queryFolderCount();           break;
+        default:                    return false;
+    }
+    return true;
+}
+
+uint16_t get16(uint8_t const *p) { return p[0] | (p[1] << 8); }
+
+// Finds the dump in `bytes` and decodes its records.  Returns false if there
+// isn't a complete one.
+bool parse(std::vector<uint8_t> const &bytes, std::vector<TraceRecord> *records) {
+    static uint8_t const signature[] = {'S', 'A', 'T', '1'};
+    for (size_t i = 0; i + 6 <= bytes.size(); ++i) {
+        if (memcmp(&bytes[i], signature, sizeof(signature)) != 0) continue;
+        auto const *p = &bytes[i + 4];
+        auto const count = get16(p);
+        p += 2;
+        if (static_cast<size_t>(p - bytes.data()) + 8u * count > bytes.size()) {
+            return false;
+        }
+        records->clear();
+        for (uint16_t n = 0; n < count; ++n, p += 8) {
+            auto const time = get16(p) | (static_cast<uint32_t>(get16(p + 2)) << 16);
+            records->push_back(TraceRecord{time, p[4], p[5], get16(p + 6)});
+        }
+        return true;
+    }
+    return false;
+}
+
+class Replay {
+    public:
+        explicit Replay(std::vector<TraceRecord> const &records) :
+            m_records(records), m_hooks(m_origin) {}
+
+        // Returns the number of mismatches.
+        unsigned run() {
+            if (m_records.empty()) return 0;
+            m_origin = m_records.front().time;
+            ::host::useManualClock(m_origin);
+            m_audio.begin(m_stream);
+
+            printf("%10s %8s %-10s %s\n", "ms", "skew", "what", "frame");
+            for (auto const &r : m_records) {
+                runUntil(r.time);
+                switch (r.flags & TraceRecord::KIND) {
+                    case TraceRecord::SENT:      expect(r);  break;
+                    case TraceRecord::RECEIVED:  deliver(r); break;
+                    case TraceRecord::REQUESTED: ask(r);     break;
+                    default: break;
+                }
+            }
+            // Give the library a moment to send anything it still owes.
+            runUntil(micros() + 100000u);
+            for (auto const &extra : m_stream.sent()) {
+                line(extra.time, "extra", extra.msgid, extra.param);
+                printf("  (not in the trace)\n");
+                ++m_mismatches;
+            }
+            printf("%zu records, %u sent frames matched, %u mismatches\n",
+                   m_records.size(), m_matched, m_mismatches);
+            return m_mismatches;
+        }
+
+    private:
+        void runUntil(uint32_t time) {
+            while (static_cast<int32_t>(time - micros()) > 0) {
+                m_audio.update(m_hooks);
+                ::host::advanceMicros(min(100u, time - micros()));
+            }
+            m_audio.update(m_hooks);
+        }
+
+        void line(uint32_t time, char const *what, uint8_t msgid,
+                  uint16_t param) const {
+            printf("%10.3f %8s %-10s 0x%02X 0x%04X", (time - m_origin) / 1000.0,
+                   "", what, msgid, param);
+        }
+
+        void expect(TraceRecord const &r) {
+            auto &sent = m_stream.sent();
+            bool const feedback = (r.flags & TraceRecord::FEEDBACK) != 0;
+            if (sent.empty()) {
+                line(r.time, "sent", r.msgid, r.param);
+                printf("  MISSING (the library didn't send it)\n");
+                ++m_mismatches;
+                return;
+            }
+            auto const actual = sent.front();
+            sent.pop_front();
+            auto const skew = static_cast<int32_t>(actual.time - r.time);
+            printf("%10.3f %+8.3f %-10s 0x%02X 0x%04X%s",
+                   (r.time - m_origin) / 1000.0, skew / 1000.0, "sent",
+                   r.msgid, r.param, feedback ? " ack" : "");
+            if (actual.msgid != r.msgid || actual.param != r.param ||
+                actual.feedback != feedback) {
+                printf("  MISMATCH (library sent 0x%02X 0x%04X%s)\n",
+                       actual.msgid, actual.param,
+                       actual.feedback ? " ack" : "");
+                ++m_mismatches;
+                return;
+            }
+            printf("\n");
+            ++m_matched;
+        }
+
+        void deliver(TraceRecord const &r) {
+            MessageBuffer frame(r.msgid, r.param, false);
+            uint8_t bytes[10];  // a frame with a two-byte payload
+            auto const length = frame.getLength();
+            memcpy(bytes, frame.getBytes(), length);
+            bool const corrupt = (r.flags & TraceRecord::CORRUPT) != 0;
+            if (corrupt) bytes[length - 2] ^= 0x5A;  // the checksum's low byte
+            m_stream.deliver(bytes, static_cast<uint8_t>(length));
+            line(r.time, "received", r.msgid, r.param);
+            printf("%s\n", corrupt ? " (bad checksum)" : "");
+        }
+
+        void ask(TraceRecord const &r) {
+            line(r.time, "requested", r.msgid, r.param);
+            if (request(m_audio, r.msgid, r.param)) {
+                printf("\n");
+            } else {
+                printf("  (can't replay this request)\n");
+            }
+        }
+
+        std::vector<TraceRecord> const &m_records;
+        uint32_t      m_origin = 0;
+        ReplayStream  m_stream;
+        SerialAudio   m_audio;
+        PrintingHooks m_hooks;
+        unsigned      m_matched = 0;
+        unsigned      m_mismatches = 0;
+};
+
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s trace-file\n", argv[0]);
+        return 2;
+    }
+    auto *file = fopen(argv[1], "rb");
+    if (file == nullptr) {
+        perror(argv[1]);
+        return 2;
+    }
+    std::vector<uint8_t> bytes;
+    for (int c = fgetc(file); c != EOF; c = fgetc(file)) {
+        bytes.push_back(static_cast<uint8_t>(c));
+    }
+    fclose(file);
+
+    std::vector<TraceRecord> records;
+    if (!parse(bytes, &records)) {
+        fprintf(stderr, "%s: no complete trace found\n", argv[1]);
+        return 2;
+    }
+    return Replay(records).run() == 0 ? 0 : 1;
+}
@@ -0,0 +1,225 @@
+// Plays an emulated module around the clock for days of simulated time, while
+// injecting the kinds of trouble an installation sees:  line noise, lost
+// replies, bursts of timeouts, power glitches, and a card pulled and pushed
+// back in.  The sketch it runs is what a robust installation would do:  play
+// a repeating playlist and restart it whenever the module comes back.
+//
+// The simulation starts a few minutes before millis() rolls over, and it
+// reports a stall if no track finishes for much longer than a track plays.
+// Everything runs on the manual clock, so a simulated day takes seconds.
+//
+//     soak [days [seed]]    (at most 40 days)
+//
+// To make SerialAudio's clock roll over every minute instead of once, build
+// with -DAIDTOPIA_SERIALAUDIO_CLOCK=::host::Millis16Clock.
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "AidtopiaSerialAudio.h"
+#include "emulator.h"
+
+#if !AIDTOPIA_SERIALAUDIO_PLAYLIST || !AIDTOPIA_SERIALAUDIO_TRACE || \
+    !AIDTOPIA_SERIALAUDIO_BACKGROUND_TASKS
+#error "soak.cpp needs playlists, tracing, and background queries (see README.md)"
+#endif
+
+using aidtopia::SerialAudio;
+using aidtopia::TraceBuffer;
+using aidtopia::TraceRecord;
+using aidtopia::host::Media;
+using aidtopia::host::ModuleEmulator;
+
+namespace {
+
+constexpr uint32_t TRACK_LENGTH = 20000;    // ms
+constexpr uint32_t STALL_LIMIT = 6 * TRACK_LENGTH;
+constexpr uint8_t  SDCARD = 0x02;
+constexpr uint32_t MS_PER_DAY = 24ul * 60 * 60 * 1000;
+
+// A small, deterministic generator so that a seed reproduces a run.
+class Random {
+    public:
+        explicit Random(uint32_t seed) : m_state(2 * seed + 1) {}
+        uint32_t next() {
+            m_state ^= m_state << 13;
+            m_state ^= m_state >> 17;
+            m_state ^= m_state << 5;
+            return m_state;
+        }
+        uint32_t between(uint32_t lo, uint32_t hi) {
+            return lo + next() % (hi - lo + 1);
+        }
+
+    private:
+        uint32_t m_state;
+};
+
+enum Fault : uint8_t {
+    GARBLE, LOSE_ONE, TIMEOUT_STORM, POWER_GLITCH, CARD_PULLED, FAULT_COUNT
+};
+char const *const faultNames[FAULT_COUNT] = {
+    "garbled frame", "lost reply", "timeout storm", "power glitch",
+    "card pulled"
+};
+
+class Installation : public SerialAudio::Hooks {
+    public:
+        explicit Installation(SerialAudio &audio) :
+            m_audio(audio),
+            m_playlist(SerialAudio::Playlist::folder(1, 1, 10)) {
+            m_playlist.setRepeat(SerialAudio::Playlist::Repeat::ALL);
+        }
+
+        void start() {
+            m_audio.selectSource(Device::SDCARD);
+            m_audio.play(m_playlist);
+            ++m_starts;
+        }
+
+        unsigned finished() const { return m_finished; }
+        unsigned starts() const { return m_starts; }
+        unsigned errors() const { return m_errors; }
+
+    private:
+        void onInitComplete(Devices devices) override {
+            if (devices.has(Device::SDCARD)) start();
+        }
+        void onDeviceChange(Device src, DeviceChange change) override {
+            if (src == Device::SDCARD && change == DeviceChange::INSERTED) {
+                start();
+            }
+        }
+        void onFinishedFile(Device, uint16_t) override { ++m_finished; }
+        void onError(Error, ID) override {
+            ++m_errors;
+            // A lost play command leaves nothing playing.
+            if (!m_audio.playingPlaylist()) start();
+        }
+
+        SerialAudio           &m_audio;
+        SerialAudio::Playlist  m_playlist;
+        unsigned               m_finished = 0;
+        unsigned               m_starts = 0;
+        unsigned               m_errors = 0;
+};
+
+void dumpTrace(aidtopia::Trace const &trace) {
+    static char const *const kinds[] = {"?", "sent", "received", "requested"};
+    for (uint16_t i = 0; i < trace.size(); ++i) {
+        auto const &r = trace[i];
+        printf("    %10lu us  %-9s 0x%02X %04X%s\n",
+               static_cast<unsigned long>(r.time),
+               kinds[r.flags & TraceRecord::KIND], r.msgid, r.param,
+               (r.flags & TraceRecord::CORRUPT) ? " (corrupt)" : "");
+    }
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    // The simulated time is kept in 32 bits of milliseconds.
+    auto days = argc > 1 ? strtoul(argv[1], nullptr, 10) : 7ul;
+    if (days > 40) days = 40;
+    auto const seed = argc > 2 ? strtoul(argv[2], nullptr, 10) : 1ul;
+
+    // Ten minutes before millis() rolls over.
+    ::host::useManualClock((0x100000000ull - 10ull * 60 * 1000) * 1000);
+
+    ModuleEmulator module(aidtopia::host::DFPLAYER_MINI);
+    Media const card{10, 10, 0, 0};
+    module.insertDevice(SDCARD, card);
+    module.setTrackLength(TRACK_LENGTH);
+    module.powerOn();
+
+    SerialAudio audio;
+    Installation installation(audio);
+    TraceBuffer<48> trace;
+    audio.useTrace(&trace);
+    audio.begin(module);
+    audio.addBackgroundQuery(SerialAudio::Parameter::STATUS, 5000);
+
+    Random random(static_cast<uint32_t>(seed));
+    unsigned faults[FAULT_COUNT] = {};
+    unsigned stalls = 0;
+    unsigned rollovers = 0;
+    auto lastClock = SerialAudio::Clock::now();
+    uint32_t nextFault = random.between(60000, 600000);
+    uint32_t cardBackAt = 0;
+    uint32_t progressAt = 0;
+    unsigned progress = 0;
+    uint32_t longestGap = 0;
+    bool stalled = false;
+
+    printf("Soaking %s for %lu days (seed %lu)\n",
+           module.profile().name, days, seed);
+    for (uint32_t t = 0, day = 0; day < days; ) {
+        audio.update(installation);
+        // Now and then, the sketch is busy with something else (redrawing a
+        // display, say) and doesn't call `update` for a while.
+        auto const step = random.next() % 16 == 0 ? random.between(2, 100) : 1;
+        ::host::advanceMillis(step);
+        t += step;
+
+        auto const now = SerialAudio::Clock::now();
+        if (now < lastClock) ++rollovers;
+        lastClock = now;
+
+        if (t >= nextFault) {
+            auto const fault = static_cast<Fault>(random.next() % FAULT_COUNT);
+            ++faults[fault];
+            switch (fault) {
+                case GARBLE:        module.garbleIncoming(1); break;
+                case LOSE_ONE:      module.loseOutgoing(1); break;
+                case TIMEOUT_STORM: module.loseOutgoing(8); break;
+                case POWER_GLITCH:  module.powerOn(); break;
+                case CARD_PULLED:
+                    module.removeDevice(SDCARD);
+                    cardBackAt = t + random.between(1000, 30000);
+                    break;
+                case FAULT_COUNT: break;
+            }
+            nextFault = t + random.between(60000, 600000);
+        }
+        if (cardBackAt != 0 && t >= cardBackAt) {
+            module.insertDevice(SDCARD, card);
+            cardBackAt = 0;
+            progressAt = t;
+        }
+
+        if (installation.finished() != progress || cardBackAt != 0) {
+            progress = installation.finished();
+            progressAt = t;
+        }
+        auto const gap = t - progressAt;
+        if (gap > longestGap) longestGap = gap;
+        if (gap < STALL_LIMIT) {
+            stalled = false;
+        } else if (!stalled) {
+            stalled = true;
+            ++stalls;
+            printf("  stall at %lu ms (clock %lu):  nothing finished for "
+                   "%lu ms\n", static_cast<unsigned long>(t),
+                   static_cast<unsigned long>(now),
+                   static_cast<unsigned long>(gap));
+            dumpTrace(trace);
+        }
+
+        if (t >= (day + 1) * MS_PER_DAY) {
+            ++day;
+            printf("  day %lu: %u tracks, %u starts, %u errors, "
+                   "%u clock rollovers\n", static_cast<unsigned long>(day),
+                   installation.finished(), installation.starts(),
+                   installation.errors(), rollovers);
+        }
+    }
+
+    for (int f = 0; f < FAULT_COUNT; ++f) {
+        printf("  %-16s %u\n", faultNames[f], faults[f]);
+    }
+    printf("  longest gap between tracks %lu ms\n",
+           static_cast<unsigned long>(longestGap));
+    printf("  %u stalls, %u dropped frames\n", stalls,
+           static_cast<unsigned>(audio.droppedFrames()));
+    return stalls == 0 ? 0 : 1;
+}
@@ -21,6 +21,164 @@ static bool isTimeout(Message const &msg) {
            msg.getParam() == static_cast<uint16_t>(SerialAudio::Error::TIMEDOUT);
 }
 
+// Fallback timeouts (ms) used until the latencies have been observed.
+static uint16_t defaultTimeout(Message::ID msgid) {
+    switch (msgid) {
+        // Counting files can take a long time on a large card.
+        case Message::ID::USBFILECOUNT:
+        case Message::ID::SDFILECOUNT:
+        case Message::ID::FLASHFILECOUNT:
+        case Message::ID::FOLDERFILECOUNT:
+        case Message::ID::FOLDERCOUNT:
+            return 1000;
+        // At 9600 baud, each extra data byte adds about a millisecond.
+        case Message::ID::PLAYLIST:
+            return 40 + MessageBuffer::MAX_DATA;
+        default:
+            return isQuery(msgid) ? 100 : 30;
+    }
+}
+
+// Returns the CommandClass bit for commands that may be sent without feedback,
+// or 0 for those that always need it.
+static uint8_t commandClass(Message::ID msgid) {
+    using CommandClass = SerialAudio::CommandClass;
+    CommandClass cc;
+    switch (msgid) {
+        case Message::ID::PLAYNEXT:
+        case Message::ID::PLAYPREVIOUS:
+        case Message::ID::PLAYFILE:
+        case Message::ID::PLAYFROMFOLDER:
+        case Message::ID::PLAYFROMMP3:
+        case Message::ID::PLAYFROMBIGFOLDER:
+        case Message::ID::PLAYWITHVOLUME:
+        case Message::ID::PLAYLIST:
+        case Message::ID::STOP:
+        case Message::ID::PAUSE:
+        case Message::ID::UNPAUSE:          cc = CommandClass::TRANSPORT; break;
+        case Message::ID::VOLUMEUP:
+        case Message::ID::VOLUMEDOWN:
+        case Message::ID::SETVOLUME:        cc = CommandClass::VOLUME;    break;
+        case Message::ID::SETEQPROFILE:     cc = CommandClass::EQ;        break;
+        case Message::ID::LOOPFILE:
+        case Message::ID::LOOPALL:
+        case Message::ID::LOOPFOLDER:
+        case Message::ID::RANDOMPLAY:
+        case Message::ID::LOOPCURRENTTRACK: cc = CommandClass::SEQUENCE;  break;
+        case Message::ID::INSERTADVERT:
+        case Message::ID::INSERTADVERTN:
+        case Message::ID::STOPADVERT:       cc = CommandClass::ADVERT;    break;
+        default: return 0;
+    }
+    return static_cast<uint8_t>(cc);
+}
+
+// Reports oddities on the serial monitor.
+static void diagnose(__FlashStringHelper const *message) {
+#if AIDTOPIA_SERIALAUDIO_DIAGNOSTICS
+    Serial.println(message);
+#else
+    (void)message;
+#endif
+}
+
+// Device discovery checks whether a storage device is present by counting its
+// files.
+static SerialAudio::Device const discoverable[] = {
+    SerialAudio::Device::USB, SerialAudio::Device::SDCARD,
+    SerialAudio::Device::FLASH
+};
+
+static Message::ID fileCountQuery(SerialAudio::Device device) {
+    switch (device) {
+        case SerialAudio::Device::USB:    return Message::ID::USBFILECOUNT;
+        case SerialAudio::Device::SDCARD: return Message::ID::SDFILECOUNT;
+        case SerialAudio::Device::FLASH:  return Message::ID::FLASHFILECOUNT;
+        default:                          return Message::ID::NONE;
+    }
+}
+
+static SerialAudio::Device countedDevice(Message::ID msgid) {
+    switch (msgid) {
+        case Message::ID::USBFILECOUNT:   return SerialAudio::Device::USB;
+        case Message::ID::SDFILECOUNT:    return SerialAudio::Device::SDCARD;
+        case Message::ID::FLASHFILECOUNT: return SerialAudio::Device::FLASH;
+        default:                          return SerialAudio::Device::NONE;
+    }
+}
+
+// The requests that only some variants support.
+enum : uint8_t {
+    CAN_QUERY_FIRMWARE  = 0x01,
+    CAN_PLAY_MP3_FOLDER = 0x02,
+    CAN_INSERT_ADVERT   = 0x04,
+    CAN_COMBINE_PLAY    = 0x08,  // the 0x21 playlist command
+    CAN_DO_EVERYTHING   = 0x0F
+};
+
+// Indexed by SerialAudio::Variant.  An unknown module gets the benefit of the
+// doubt.  The Catalex's YX5300 datasheet documents 0x21, but not the "MP3" or
+// "ADVERT" folders.  (See extras/serial_audio_players.md.)
+static uint8_t const capabilityTable[] = {
+    /* UNKNOWN */       CAN_DO_EVERYTHING,
+    /* DFPLAYER_MINI */ CAN_DO_EVERYTHING,
+    /* CATALEX */       CAN_COMBINE_PLAY,
+    /* CLONE */         CAN_QUERY_FIRMWARE | CAN_PLAY_MP3_FOLDER |
+                        CAN_INSERT_ADVERT
+};
+
+static uint8_t capabilityFor(Message::ID msgid) {
+    switch (msgid) {
+        case Message::ID::FIRMWAREVERSION:  return CAN_QUERY_FIRMWARE;
+        case Message::ID::PLAYFROMMP3:      return CAN_PLAY_MP3_FOLDER;
+        case Message::ID::INSERTADVERT:
+        case Message::ID::INSERTADVERTN:    return CAN_INSERT_ADVERT;
+        case Message::ID::PLAYLIST:         return CAN_COMBINE_PLAY;
+        default:                            return 0;
+    }
+}
+
+// True if sending the command twice has the same effect as sending it once.
+static bool isIdempotent(Message::ID msgid) {
+    switch (msgid) {
+        case Message::ID::PLAYNEXT:
+        case Message::ID::PLAYPREVIOUS:
+        case Message::ID::VOLUMEUP:
+        case Message::ID::VOLUMEDOWN:
+        case Message::ID::INSERTADVERT:
+        case Message::ID::INSERTADVERTN:
+            return false;
+        default:
+            return true;
+    }
+}
+
+// True if the command does nothing but start a track.
+static bool startsTrack(Message::ID msgid) {
+    switch (msgid) {
+        case Message::ID::PLAYNEXT:
+        case Message::ID::PLAYPREVIOUS:
+        case Message::ID::PLAYFILE:
+        case Message::ID::PLAYFROMFOLDER:
+        case Message::ID::PLAYFROMMP3:
+        case Message::ID::PLAYFROMBIGFOLDER:
+        case Message::ID::PLAYWITHVOLUME:
+        case Message::ID::PLAYLIST:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static Message::ID currentFileQuery(SerialAudio::Device device) {
+    switch (device) {
+        case SerialAudio::Device::USB:    return Message::ID::CURRENTUSBFILE;
+        case SerialAudio::Device::SDCARD: return Message::ID::CURRENTSDFILE;
+        case SerialAudio::Device::FLASH:  return Message::ID::CURRENTFLASHFILE;
+        default:                          return Message::ID::NONE;
+    }
+}
+
 static bool isNoSources(Message const &msg) {
     return isError(msg) &&
            msg.getParam() == static_cast<uint16_t>(SerialAudio::Error::NOSOURCES);
@@ -38,6 +196,10 @@ SerialAudio::Devices &SerialAudio::Devices::operator|=(SerialAudio::Devices cons
     return *this;
 }
 
+uint8_t SerialAudio::Devices::bitmask() const {
+    return m_bitmask;
+}
+
 bool SerialAudio::Devices::empty() const {
     return m_bitmask == 0;
 }
@@ -86,15 +248,54 @@ bool SerialAudio::update()             { return update(nullptr); }
 bool SerialAudio::update(Hooks &hooks) { return update(&hooks);  }
 
 bool SerialAudio::update(Hooks *hooks) {
+    return update(hooks, Clock::now());
+}
+
+bool SerialAudio::update(Hooks *hooks, TimeRep now) {
+    // Everything in this pass, including the frames it reads and any requests
+    // the hooks make, happens at `now`.  That's as fine as the latencies and
+    // timeouts need, and it saves reading the clock over and over.
+    m_now = now;
+    m_updating = true;
+#if AIDTOPIA_SERIALAUDIO_EVENT_QUEUE_DEPTH
+    if (m_deferEvents) hooks = &m_events;
+#endif
+#if AIDTOPIA_SERIALAUDIO_BUSY
+    if (m_busySource != nullptr) checkBusy(hooks);
+#endif
+    checkTransmission(now);
     Message msg;
-    if (m_core.update(&msg)) onEvent(msg, hooks);
-    if (m_timeout.expired()) {
+    for (uint8_t i = 0; i < m_frameBudget && m_core.update(&msg); ++i) {
+        onEvent(msg, hooks);
+    }
+#if AIDTOPIA_SERIALAUDIO_BACKGROUND_TASKS || AIDTOPIA_SERIALAUDIO_VARIANT_PROBE
+    if (m_abandoned != Message::ID::NONE && m_abandonedTimeout.expired(now)) {
+        // Its response was lost, so a later one is for someone else.
+        m_abandoned = Message::ID::NONE;
+        m_abandonedTimeout.cancel();
+    }
+#endif
+    if (m_timeout.expired(now)) {
         auto const timeout =
             Message{Message::ID::ERROR, static_cast<uint16_t>(Error::TIMEDOUT)};
         onEvent(timeout, hooks);
     }
+    completeLocally(hooks);
+#if AIDTOPIA_SERIALAUDIO_CUE
+    if (m_cue != nullptr) stepCue(now);
+#endif
     dispatch();
-    return !m_queue.full();
+#if AIDTOPIA_SERIALAUDIO_VARIANT_PROBE
+    probeVariant(now);
+#endif
+#if AIDTOPIA_SERIALAUDIO_BACKGROUND_TASKS
+    runBackground(now);
+#endif
+#if AIDTOPIA_SERIALAUDIO_EVENT_QUEUE_DEPTH
+    m_stats.events(m_events.size());
+#endif
+    m_updating = false;
+    return !m_commands.full() && !m_queries.full();
 }
 
 SerialAudio::Hooks::~Hooks() {}
@@ -130,210 +331,1269 @@ void SerialAudio::Hooks::handleInitComplete(Devices devices) {
     m_indexLastFinished = 0;
 }
 
+void SerialAudio::Hooks::handleTrackStarted() { onTrackStarted(); }
+void SerialAudio::Hooks::handleTrackEnded() { onTrackEnded(); }
+void SerialAudio::Hooks::handleAdvertFinished() { onAdvertFinished(); }
+
+#if AIDTOPIA_SERIALAUDIO_EVENT_QUEUE_DEPTH
+void SerialAudio::deferEvents(bool defer) {
+    m_deferEvents = defer;
+}
+
+uint8_t SerialAudio::pollEvents(Hooks &hooks, uint8_t limit) {
+    return m_events.deliver(hooks, limit);
+}
+
+uint8_t SerialAudio::EventRing::deliver(Hooks &hooks, uint8_t limit) {
+    uint8_t count = 0;
+    while (count < limit && !m_ring.empty()) {
+        // Copy and pop first, in case a hook calls back into the library.
+        auto const event = m_ring.peekFront();
+        m_ring.popFront();
+        switch (event.type) {
+            case Type::ERROR:
+                hooks.onError(static_cast<Error>(event.value),
+                              static_cast<Message::ID>(event.detail));
+                break;
+            case Type::QUERY_RESPONSE:
+                hooks.onQueryResponse(static_cast<Parameter>(event.detail),
+                                      event.value);
+                break;
+            case Type::DEVICE_CHANGE:
+                hooks.onDeviceChange(static_cast<Device>(event.detail),
+                                     static_cast<DeviceChange>(event.value));
+                break;
+            case Type::FINISHED_FILE:
+                hooks.onFinishedFile(static_cast<Device>(event.detail),
+                                     event.value);
+                break;
+            case Type::INIT_COMPLETE:
+                hooks.onInitComplete(Devices(event.detail));
+                break;
+            case Type::TRACK_STARTED:   hooks.onTrackStarted();   break;
+            case Type::TRACK_ENDED:     hooks.onTrackEnded();     break;
+            case Type::ADVERT_FINISHED: hooks.onAdvertFinished(); break;
+        }
+        ++count;
+    }
+    return count;
+}
+
+void SerialAudio::EventRing::record(Type type, uint8_t detail, uint16_t value) {
+    if (!m_ring.pushBack(Event{type, detail, value})) ++m_dropped;
+}
+
+void SerialAudio::EventRing::onError(Error code, Message::ID msgid) {
+    record(Type::ERROR, static_cast<uint8_t>(msgid),
+           static_cast<uint16_t>(code));
+}
+
+void SerialAudio::EventRing::onQueryResponse(Parameter param, uint16_t value) {
+    record(Type::QUERY_RESPONSE, static_cast<uint8_t>(param), value);
+}
+
+void SerialAudio::EventRing::onDeviceChange(Device src, DeviceChange change) {
+    record(Type::DEVICE_CHANGE, static_cast<uint8_t>(src),
+           static_cast<uint16_t>(change));
+}
+
+void SerialAudio::EventRing::onFinishedFile(Device device, uint16_t index) {
+    record(Type::FINISHED_FILE, static_cast<uint8_t>(device), index);
+}
+
+void SerialAudio::EventRing::onInitComplete(Devices devices) {
+    record(Type::INIT_COMPLETE, devices.bitmask());
+}
+
+void SerialAudio::EventRing::onTrackStarted() { record(Type::TRACK_STARTED, 0); }
+void SerialAudio::EventRing::onTrackEnded() { record(Type::TRACK_ENDED, 0); }
+void SerialAudio::EventRing::onAdvertFinished() {
+    record(Type::ADVERT_FINISHED, 0);
+}
+#endif
+
 // Unless a subclass provides overrides, the hooks do nothing.
 void SerialAudio::Hooks::onError(Error, ID) {}
 void SerialAudio::Hooks::onQueryResponse(Parameter, uint16_t) {}
 void SerialAudio::Hooks::onDeviceChange(Device, DeviceChange) {}
 void SerialAudio::Hooks::onFinishedFile(Device, uint16_t) {}
 void SerialAudio::Hooks::onInitComplete(Devices) {}
-
-void SerialAudio::reset() {
-    m_queue.clear();
-    dispatch(Message::ID::RESET, State::EXPECT_ACK | State::UNINITIALIZED);
-    m_timeout.set(3000);
+void SerialAudio::Hooks::onTrackStarted() {}
+void SerialAudio::Hooks::onTrackEnded() {}
+void SerialAudio::Hooks::onAdvertFinished() {}
+
+Ticket SerialAudio::reset() {
+    dropRequests();
+    m_named.clear();
+    m_toCheck.clear();
+#if AIDTOPIA_SERIALAUDIO_PLAYLIST
+    m_playlist = nullptr;
+#endif
+#if AIDTOPIA_SERIALAUDIO_CUE
+    m_cue = nullptr;
+#endif
+    auto const ticket = m_tickets.issue();
+    dispatch(Message::ID::RESET, State::EXPECT_ACK | State::UNINITIALIZED, 0,
+             ticket);
+    startTimeout(3000);
+    return ticket;
 }
 
-void SerialAudio::queryFileCount(Device device) {
-    // TODO: We need to ensure these get a longer timeout.
-    Message::ID msgid;
-    switch (device) {
-        case Device::USB:    msgid = Message::ID::USBFILECOUNT;    break;
-        case Device::SDCARD: msgid = Message::ID::SDFILECOUNT;     break;
-        case Device::FLASH:  msgid = Message::ID::FLASHFILECOUNT;  break;
-        default:  return;
-    }
-    enqueue(msgid, State::EXPECT_RESPONSE);
+Ticket SerialAudio::queryFileCount(Device device) {
+    auto const msgid = fileCountQuery(device);
+    if (msgid == Message::ID::NONE) return NO_TICKET;
+    return enqueue(msgid);
 }
 
-void SerialAudio::queryFirmwareVersion() {
-    enqueue(Message::ID::FIRMWAREVERSION, State::EXPECT_RESPONSE);
+Ticket SerialAudio::queryFirmwareVersion() {
+    return enqueue(Message::ID::FIRMWAREVERSION);
 }
 
-void SerialAudio::selectSource(Device source) {
+Ticket SerialAudio::selectSource(Device source) {
     auto const paramLo = static_cast<uint8_t>(source);
-    enqueue(Message::ID::SELECTSOURCE, State::EXPECT_ACK | State::DELAY,
-            combine(0, paramLo));
+    return enqueue(Message::ID::SELECTSOURCE, combine(0, paramLo));
 }
 
-void SerialAudio::queryStatus() {
-    // TODO:  Might need a longer timeout.
-    enqueue(Message::ID::STATUS, State::EXPECT_RESPONSE);
+Ticket SerialAudio::queryStatus() {
+    return enqueue(Message::ID::STATUS);
 }
 
-void SerialAudio::setVolume(uint8_t volume) {
+Ticket SerialAudio::setVolume(uint8_t volume) {
     volume = min(volume, 30);
-    enqueue(Message::ID::SETVOLUME, State::EXPECT_ACK, volume);
+    return enqueue(Message::ID::SETVOLUME, volume);
 }
 
-void SerialAudio::increaseVolume() {
-    enqueue(Message::ID::VOLUMEUP, State::EXPECT_ACK);
+Ticket SerialAudio::increaseVolume() {
+    return enqueue(Message::ID::VOLUMEUP);
 }
 
-void SerialAudio::decreaseVolume() {
-    enqueue(Message::ID::VOLUMEDOWN, State::EXPECT_ACK);
+Ticket SerialAudio::decreaseVolume() {
+    return enqueue(Message::ID::VOLUMEDOWN);
 }
 
-void SerialAudio::queryVolume() {
-    enqueue(Message::ID::VOLUME, State::EXPECT_RESPONSE);
+Ticket SerialAudio::queryVolume() {
+    return enqueue(Message::ID::VOLUME);
 }
 
-void SerialAudio::setEqProfile(EqProfile eq) {
-    enqueue(Message::ID::SETEQPROFILE, State::EXPECT_ACK,
-            static_cast<uint16_t>(eq));
+Ticket SerialAudio::setEqProfile(EqProfile eq) {
+    return enqueue(Message::ID::SETEQPROFILE, static_cast<uint16_t>(eq));
 }
 
-void SerialAudio::queryEqProfile() {
-    enqueue(Message::ID::EQPROFILE, State::EXPECT_RESPONSE);
+Ticket SerialAudio::queryEqProfile() {
+    return enqueue(Message::ID::EQPROFILE);
 }
 
-void SerialAudio::playFile(uint16_t index) {
-    enqueue(Message::ID::PLAYFILE, State::EXPECT_ACK, index);
+Ticket SerialAudio::playFile(uint16_t index) {
+    return enqueue(Message::ID::PLAYFILE, index);
 }
 
-void SerialAudio::playNextFile() {
-    enqueue(Message::ID::PLAYNEXT, State::EXPECT_ACK);
+Ticket SerialAudio::playNextFile() {
+    return enqueue(Message::ID::PLAYNEXT);
 }
 
-void SerialAudio::playPreviousFile() {
-    enqueue(Message::ID::PLAYPREVIOUS, State::EXPECT_ACK);
+Ticket SerialAudio::playPreviousFile() {
+    return enqueue(Message::ID::PLAYPREVIOUS);
 }
 
-void SerialAudio::loopFile(uint16_t index) {
-    enqueue(Message::ID::LOOPFILE, State::EXPECT_ACK, index);
+Ticket SerialAudio::loopFile(uint16_t index) {
+    return enqueue(Message::ID::LOOPFILE, index);
 }
 
-void SerialAudio::loopAllFiles() {
-    enqueue(Message::ID::LOOPALL, State::EXPECT_ACK);
+Ticket SerialAudio::loopAllFiles() {
+    return enqueue(Message::ID::LOOPALL);
 }
 
-void SerialAudio::playFilesInRandomOrder() {
-    enqueue(Message::ID::RANDOMPLAY, State::EXPECT_ACK);
+Ticket SerialAudio::playFilesInRandomOrder() {
+    return enqueue(Message::ID::RANDOMPLAY);
 }
 
-void SerialAudio::queryCurrentFile(Device device) {
-    auto msgid = Message::ID::NONE;
-    switch (device) {
-        case Device::USB:    msgid = Message::ID::CURRENTUSBFILE;   break;
-        case Device::SDCARD: msgid = Message::ID::CURRENTSDFILE;    break;
-        case Device::FLASH:  msgid = Message::ID::CURRENTFLASHFILE; break;
-        default: return;
-    }
-    enqueue(msgid, State::EXPECT_RESPONSE);
+Ticket SerialAudio::queryCurrentFile(Device device) {
+    auto const msgid = currentFileQuery(device);
+    if (msgid == Message::ID::NONE) return NO_TICKET;
+    return enqueue(msgid);
 }
 
-void SerialAudio::queryFolderCount() {
-    enqueue(Message::ID::FOLDERCOUNT, State::EXPECT_RESPONSE);
+Ticket SerialAudio::queryFolderCount() {
+    return enqueue(Message::ID::FOLDERCOUNT);
 }
 
-void SerialAudio::queryFolderFileCount(uint16_t folder) {
-    enqueue(Message::ID::FOLDERFILECOUNT, State::EXPECT_RESPONSE, folder);
+Ticket SerialAudio::queryFolderFileCount(uint16_t folder) {
+    return enqueue(Message::ID::FOLDERFILECOUNT, folder);
 }
 
-void SerialAudio::loopFolder(uint16_t folder) {
+Ticket SerialAudio::loopFolder(uint16_t folder) {
     // Note that this command ACKs twice when successful.  I think one is for
     // the command to put it into loop folder mode and the second is when it
     // actually begins playing.
-    enqueue(Message::ID::LOOPFOLDER, State::EXPECT_ACK | State::EXPECT_ACK2,
-            folder);
+    return enqueue(Message::ID::LOOPFOLDER, folder);
+}
+
+#if AIDTOPIA_SERIALAUDIO_FOLDER_INDEX
+void SerialAudio::useIndex(FolderIndex &index) {
+    m_index = &index;
+    m_index->load();
 }
+#endif
 
-void SerialAudio::playTrack(uint16_t track) {
-    enqueue(Message::ID::PLAYFROMMP3, State::EXPECT_ACK, track);
+Ticket SerialAudio::playTrack(uint16_t track) {
+    return enqueue(Message::ID::PLAYFROMMP3, track);
 }
 
-void SerialAudio::playTrack(uint16_t folder, uint16_t track) {
+Ticket SerialAudio::playTrack(uint16_t folder, uint16_t track) {
     if (track < 256) {
         auto const param = combine(
             static_cast<uint8_t>(folder),
             static_cast<uint8_t>(track)
         );
-        enqueue(Message::ID::PLAYFROMFOLDER, State::EXPECT_ACK, param);
+        return enqueue(Message::ID::PLAYFROMFOLDER, param);
     } else if (folder < 16) {
         auto const param = ((folder & 0x0F) << 12) | (track & 0x0FFF);
-        enqueue(Message::ID::PLAYFROMBIGFOLDER, State::EXPECT_ACK, param);
+        return enqueue(Message::ID::PLAYFROMBIGFOLDER, param);
+    }
+    return NO_TICKET;
+}
+
+Ticket SerialAudio::loopCurrentTrack() {
+    return enqueue(Message::ID::LOOPCURRENTTRACK, 0);
+}
+
+Ticket SerialAudio::stopLoopingCurrentTrack() {
+    return enqueue(Message::ID::LOOPCURRENTTRACK, 1);
+}
+
+Ticket SerialAudio::queryPlaybackSequence() {
+    return enqueue(Message::ID::PLAYBACKSEQUENCE);
+}
+
+#if AIDTOPIA_SERIALAUDIO_MIRROR
+uint8_t SerialAudio::volume() const {
+    return m_mirror.volume();
+}
+
+SerialAudio::EqProfile SerialAudio::eqProfile() const {
+    return static_cast<EqProfile>(m_mirror.eq());
+}
+
+SerialAudio::Sequence SerialAudio::playbackSequence() const {
+    return static_cast<Sequence>(m_mirror.sequence());
+}
+
+SerialAudio::ModuleState SerialAudio::moduleState() const {
+    return static_cast<ModuleState>(m_mirror.state());
+}
+
+SerialAudio::Device SerialAudio::selectedDevice() const {
+    return static_cast<Device>(m_mirror.device());
+}
+
+bool SerialAudio::isStale(Parameter param) const {
+    switch (param) {
+        case Parameter::VOLUME:
+            return m_mirror.isStale(ModuleMirror::VOLUME);
+        case Parameter::EQPROFILE:
+            return m_mirror.isStale(ModuleMirror::EQ);
+        case Parameter::PLAYBACKSEQUENCE:
+            return m_mirror.isStale(ModuleMirror::SEQUENCE);
+        case Parameter::STATUS:
+            return m_mirror.isStale(ModuleMirror::STATUS) ||
+                   m_mirror.isStale(ModuleMirror::DEVICE);
+        default:
+            // Nothing else is mirrored.
+            return true;
+    }
+}
+
+Ticket SerialAudio::refresh(Parameter param) {
+    switch (param) {
+        case Parameter::VOLUME:             return queryVolume();
+        case Parameter::EQPROFILE:          return queryEqProfile();
+        case Parameter::PLAYBACKSEQUENCE:   return queryPlaybackSequence();
+        case Parameter::STATUS:             return queryStatus();
+        default: return NO_TICKET;
+    }
+}
+#endif
+
+#if AIDTOPIA_SERIALAUDIO_BACKGROUND_TASKS
+bool SerialAudio::addBackgroundQuery(
+    Parameter param,
+    uint16_t period,
+    uint16_t folder
+) {
+    // Message::ID::NONE stands for the selected device's current file.
+    auto const msgid = param == Parameter::CURRENTFILE ?
+        Message::ID::NONE : static_cast<Message::ID>(param);
+    if (msgid != Message::ID::FOLDERFILECOUNT) folder = 0;
+    return m_background.add(msgid, folder, period, currentTime());
+}
+
+void SerialAudio::clearBackgroundQueries() {
+    m_background.clear();
+}
+#endif
+
+#if AIDTOPIA_SERIALAUDIO_BACKGROUND_TASKS || AIDTOPIA_SERIALAUDIO_VARIANT_PROBE
+void SerialAudio::setBackgroundGuard(uint16_t guard) {
+    m_backgroundGuard = guard;
+}
+#endif
+
+#if AIDTOPIA_SERIALAUDIO_BACKGROUND_TASKS
+void SerialAudio::runBackground(TimeRep now) {
+    if (!m_state.ready() || !m_commands.empty() || !m_queries.empty()) return;
+    if (m_answer.getID() != Message::ID::NONE) return;
+    if (static_cast<TimeRep>(now - m_lastRequest) < m_backgroundGuard) return;
+    auto const *task = m_background.take(now);
+    if (task == nullptr) return;
+    auto msgid = task->msgid;
+    if (msgid == Message::ID::NONE) {
+        if (m_mirror.isStale(ModuleMirror::DEVICE)) return;
+        msgid = currentFileQuery(static_cast<Device>(m_mirror.device()));
+        if (msgid == Message::ID::NONE) return;
+    }
+    dispatch(msgid, State::EXPECT_RESPONSE, task->param);
+    m_inBackground = true;
+}
+#endif
+
+#if AIDTOPIA_SERIALAUDIO_PLAYLIST
+Ticket SerialAudio::play(Playlist &playlist) {
+    m_playlist = nullptr;
+    if (!playlist.start(static_cast<uint16_t>(currentTime()))) return NO_TICKET;
+    auto const first = playlist.current();
+    auto const ticket = enqueue(first.getID(), first.getParam());
+    m_playlist = &playlist;
+    m_playlistFailures = 0;
+    m_stoppedReports = 0;
+    m_playlistOnModule = false;
+    return ticket;
+}
+
+Ticket SerialAudio::playOnModule(Playlist &playlist) {
+    uint8_t payload[MessageBuffer::MAX_DATA];
+    if (m_moduleRejectsPlaylists || !supports(Message::ID::PLAYLIST) ||
+        playlist.modulePayload(payload, sizeof(payload)) == 0
+    ) {
+        return play(playlist);
+    }
+    if (!playlist.start(0)) {
+        m_playlist = nullptr;
+        return NO_TICKET;
+    }
+    m_playlist = &playlist;
+    m_playlistFailures = 0;
+    m_stoppedReports = 0;
+    m_playlistOnModule = true;
+    // The payload is rebuilt from the playlist when the command is sent.
+    return enqueue(Message::ID::PLAYLIST);
+}
+#endif
+
+#if AIDTOPIA_SERIALAUDIO_PLAYLIST || AIDTOPIA_SERIALAUDIO_CUE
+void SerialAudio::onFinished(uint16_t index) {
+    m_stoppedReports = 0;
+#if AIDTOPIA_SERIALAUDIO_PLAYLIST
+    auto const playlist = m_playlist != nullptr;
+    auto const onModule = playlist && m_playlistOnModule;
+#else
+    auto const playlist = false;
+    auto const onModule = false;
+#endif
+#if AIDTOPIA_SERIALAUDIO_CUE
+    if (!playlist && m_cue == nullptr) return;
+#else
+    if (!playlist) return;
+#endif
+    auto const now = currentTime();
+    if (index == m_finishedIndex &&
+        static_cast<TimeRep>(now - m_finishedAt) < DUPLICATE_FINISHED_WINDOW
+    ) {
+        return;
+    }
+    m_finishedIndex = index;
+    m_finishedAt = now;
+    // With BUSY, the end of the track was already handled.
+#if AIDTOPIA_SERIALAUDIO_BUSY
+    if (m_busySource != nullptr && !onModule) return;
+#else
+    (void)onModule;
+#endif
+#if AIDTOPIA_SERIALAUDIO_PLAYLIST
+    if (playlist) {
+        advancePlaylist();
+        return;
+    }
+#endif
+#if AIDTOPIA_SERIALAUDIO_CUE
+    cueTrackEnded();
+#endif
+}
+
+// A lost FINISHED notification would leave the playlist (or a cue) waiting
+// forever.  If two status reports in a row say the module has stopped, with
+// no FINISHED in between, the current item must have finished.  (One isn't
+// enough, because a FINISHED can trail the status.)
+void SerialAudio::checkPlaylistStopped(Message const &status) {
+    auto const state =
+        static_cast<ModuleState>(status.getParam() & 0x00FF);
+    auto waiting = false;
+#if AIDTOPIA_SERIALAUDIO_PLAYLIST
+    if (m_playlist != nullptr && !m_playlistOnModule) waiting = true;
+#endif
+#if AIDTOPIA_SERIALAUDIO_CUE
+    if (cueWaitingForTrack()) waiting = true;
+#endif
+    if (!waiting || !m_commands.empty() ||
+        (state != ModuleState::STOPPED && state != ModuleState::ALT_STOPPED)
+    ) {
+        m_stoppedReports = 0;
+        return;
+    }
+    if (++m_stoppedReports < 2) return;
+#if AIDTOPIA_SERIALAUDIO_PLAYLIST
+    if (m_playlist != nullptr) {
+        advancePlaylist();
+        return;
+    }
+#endif
+    m_stoppedReports = 0;
+#if AIDTOPIA_SERIALAUDIO_CUE
+    cueTrackEnded();
+#endif
+}
+#endif
+
+#if AIDTOPIA_SERIALAUDIO_PLAYLIST
+void SerialAudio::advancePlaylist() {
+    m_playlistFailures = 0;
+    m_stoppedReports = 0;
+    if (!m_playlist->advance()) {
+        m_playlist = nullptr;
+        return;
+    }
+    // The module moves on by itself.
+    if (m_playlistOnModule) return;
+    playCurrentItem();
+}
+
+// Sends the playlist's current item without waiting behind other commands.
+void SerialAudio::playCurrentItem() {
+    auto const msg = m_playlist->current();
+    auto const cmd =
+        Command{msg.getID(), MSB(msg.getParam()), LSB(msg.getParam())};
+    if (m_state.ready()) {
+        dispatch(cmd, NO_TICKET);
+    } else if (!m_commands.pushFront(cmd, NO_TICKET)) {
+        ++m_dropped;
+        m_playlist = nullptr;
+    }
+}
+
+void SerialAudio::skipFailedItem() {
+    auto const msg = m_playlist->current();
+    if (m_state.sent() != msg.getID() || m_sentParam != msg.getParam()) return;
+    // Give up if every item has failed in a row.
+    if (++m_playlistFailures >= m_playlist->size() || !m_playlist->advance()) {
+        m_playlist = nullptr;
+        return;
+    }
+    playCurrentItem();
+}
+
+// If the module rejected its combined play command, this plays the playlist
+// from here instead.  Returns true if it did.
+bool SerialAudio::takeOverFromModule(Message::ID rejected) {
+    if (rejected != Message::ID::PLAYLIST || m_playlist == nullptr ||
+        !m_playlistOnModule
+    ) {
+        return false;
+    }
+    m_moduleRejectsPlaylists = true;
+    m_playlistOnModule = false;
+    playCurrentItem();
+    return true;
+}
+#endif
+
+#if AIDTOPIA_SERIALAUDIO_CUE
+void SerialAudio::runCue(Cue &cue) {
+#if AIDTOPIA_SERIALAUDIO_PLAYLIST
+    m_playlist = nullptr;
+#endif
+    m_stoppedReports = 0;
+    cue.start();
+    m_cue = &cue;
+    stepCue(currentTime());
+}
+
+// Runs the cue until a step has to wait.
+void SerialAudio::stepCue(TimeRep now) {
+    for (uint8_t i = 0; i < CUE_STEPS_PER_UPDATE && m_cue != nullptr; ++i) {
+        if (!runCueStep(now)) return;
     }
 }
 
-void SerialAudio::loopCurrentTrack() {
-    enqueue(Message::ID::LOOPCURRENTTRACK, State::EXPECT_ACK, 0);
+// Finishes the cue's current wait if it can, and then runs the next step.
+// Returns false if the cue has to wait.
+bool SerialAudio::runCueStep(TimeRep now) {
+    auto &cue = *m_cue;
+    auto const now16 = static_cast<uint16_t>(now);
+    switch (cue.waiting()) {
+        case Cue::Wait::NONE:
+            break;
+        case Cue::Wait::TIME:
+            if (!cue.timerExpired(now16)) return false;
+            cue.waitFor(Cue::Wait::NONE);
+            break;
+        case Cue::Wait::FINISHED: {
+            // A play command that never took effect won't finish.  Otherwise,
+            // cueTrackEnded ends the wait.
+            auto const status = m_tickets.status(cue.played());
+            if (status != TicketStatus::FAILED &&
+                status != TicketStatus::DROPPED
+            ) {
+                return false;
+            }
+            cue.waitFor(Cue::Wait::NONE);
+            break;
+        }
+        case Cue::Wait::RAMP: {
+            if (!cue.timerExpired(now16)) return false;
+            auto const target = cue.target();
+            if (cue.volume() == target) {
+                cue.waitFor(Cue::Wait::NONE);
+                break;
+            }
+            if (m_commands.full()) return false;
+            // Without a starting point, it jumps straight to the target.
+            auto volume = target;
+            if (cue.volume() < target) {
+                volume = cue.volume() + 1;
+            } else if (cue.volume() != Cue::UNKNOWN_VOLUME) {
+                volume = cue.volume() - 1;
+            }
+            cue.setVolume(volume);
+            setVolume(volume);
+            cue.restartTimer(now16);
+            return false;
+        }
+    }
+
+    auto const start = cue.position();
+    auto const op = cue.fetch();
+    // A step that sends a command waits for room in the queue.
+    if (op >= Cue::VOLUME && op <= Cue::UNPAUSE && m_commands.full()) {
+        cue.rewind(start);
+        return false;
+    }
+    m_cueing = true;
+    switch (op) {
+        case Cue::VOLUME: {
+            auto const volume = min(cue.fetch(), 30);
+            cue.setVolume(volume);
+            setVolume(volume);
+            break;
+        }
+        case Cue::SOURCE:
+            selectSource(static_cast<Device>(cue.fetch()));
+            break;
+        case Cue::EQ:
+            setEqProfile(static_cast<EqProfile>(cue.fetch()));
+            break;
+        case Cue::PLAY_FILE:
+            cue.setPlayed(playFile(cue.fetchWord()));
+            break;
+        case Cue::PLAY_TRACK:
+            cue.setPlayed(playTrack(cue.fetchWord()));
+            break;
+        case Cue::PLAY_FOLDER: {
+            auto const folder = cue.fetch();
+            cue.setPlayed(playTrack(folder, cue.fetch()));
+            break;
+        }
+        case Cue::ADVERT:       insertAdvert(cue.fetchWord());  break;
+        case Cue::STOP:         stop();                         break;
+        case Cue::PAUSE:        pause();                        break;
+        case Cue::UNPAUSE:      unpause();                      break;
+        case Cue::WAIT:
+            cue.startTimer(now16, cue.fetchWord());
+            cue.waitFor(Cue::Wait::TIME);
+            break;
+        case Cue::WAIT_FINISHED:
+            if (cue.played() != NO_TICKET) cue.waitFor(Cue::Wait::FINISHED);
+            break;
+        case Cue::RAMP: {
+            cue.setTarget(min(cue.fetch(), 30));
+            auto const step = cue.fetch();
+            if (cue.volume() == Cue::UNKNOWN_VOLUME &&
+                !m_mirror.isStale(ModuleMirror::VOLUME)
+            ) {
+                cue.setVolume(m_mirror.volume());
+            }
+            // Backdate the timer so that the first step comes right away.
+            cue.startTimer(static_cast<uint16_t>(now16 - step), step);
+            cue.waitFor(Cue::Wait::RAMP);
+            break;
+        }
+        case Cue::RESTART:
+            cue.rewind(0);
+            break;
+        default:  // END, or something that isn't an opcode
+            m_cue = nullptr;
+            break;
+    }
+    m_cueing = false;
+    return m_cue != nullptr;
 }
 
-void SerialAudio::stopLoopingCurrentTrack() {
-    enqueue(Message::ID::LOOPCURRENTTRACK, State::EXPECT_ACK, 1);
+bool SerialAudio::cueWaitingForTrack() const {
+    return m_cue != nullptr && m_cue->waiting() == Cue::Wait::FINISHED;
 }
 
-void SerialAudio::queryPlaybackSequence() {
-    enqueue(Message::ID::PLAYBACKSEQUENCE, State::EXPECT_RESPONSE);
+// Ends the cue's wait for its track, unless the track that ended can't be the
+// cue's because the module hasn't taken the play command yet.
+void SerialAudio::cueTrackEnded() {
+    if (!cueWaitingForTrack()) return;
+    auto const played = m_cue->played();
+    if (m_tickets.status(played) == TicketStatus::PENDING) return;
+    if (played == m_sentTicket && m_state.has(State::EXPECT_ACK)) return;
+    m_cue->waitFor(Cue::Wait::NONE);
 }
+#endif
 
+#if AIDTOPIA_SERIALAUDIO_BUSY
+void SerialAudio::useBusySource(BusySource *busy) {
+    m_busySource = busy;
+    m_busy = busy != nullptr && busy->busy();
+    m_resuming = false;
+}
+
+void SerialAudio::checkBusy(Hooks *hooks) {
+    // A blip counts as an end followed by a start.
+    auto const blip = m_busySource->idledSinceLastCheck();
+    auto const busy = m_busySource->busy();
+    auto const ended = m_busy && (!busy || blip);
+    auto const started = busy && (!m_busy || blip);
+    m_busy = busy;
+    if (ended) {
+        if (m_advertPlaying) {
+            // The interrupted track picks up where it left off, so this
+            // isn't the end of it.
+            m_advertPlaying = false;
+            m_resuming = true;
+            if (hooks != nullptr) hooks->handleAdvertFinished();
+        } else {
+            if (hooks != nullptr) hooks->handleTrackEnded();
+            // Unless the sketch stopped or paused it, the track finished.  A
+            // FINISHED notification may have already guessed it stopped.
+            auto const playing = static_cast<uint8_t>(ModuleState::PLAYING);
+            if (m_mirror.state() == playing ||
+                m_mirror.isStale(ModuleMirror::STATUS)
+            ) {
+#if AIDTOPIA_SERIALAUDIO_PLAYLIST
+                if (m_playlist != nullptr && !m_playlistOnModule) {
+                    advancePlaylist();
+                }
+#endif
+#if AIDTOPIA_SERIALAUDIO_CUE
+                cueTrackEnded();
+#endif
+            }
+        }
+    }
+    if (started) {
+        if (m_resuming) {
+            m_resuming = false;
+        } else if (hooks != nullptr) {
+            hooks->handleTrackStarted();
+        }
+    }
+}
+#endif
+
+#if AIDTOPIA_SERIALAUDIO_RETRY
+// Puts the command that failed back at the front of its lane and waits out
+// the backoff.  Returns false if it shouldn't be retried.
+bool SerialAudio::retry(Message const &error) {
+    auto const code = static_cast<Error>(error.getParam());
+    auto const timedOut = code == Error::TIMEDOUT;
+    if (!timedOut && code != Error::SERIALERROR && code != Error::BADCHECKSUM) {
+        return false;
+    }
+    auto const msgid = m_state.sent();
+    if (msgid == Message::ID::NONE || msgid == Message::ID::RESET ||
+        msgid == Message::ID::PLAYLIST
+    ) {
+        return false;
+    }
+    // Discovery and background queries have their own ways of recovering.
+    if (m_state.has(State::UNINITIALIZED)) return false;
+#if AIDTOPIA_SERIALAUDIO_BACKGROUND_TASKS || AIDTOPIA_SERIALAUDIO_VARIANT_PROBE
+    if (m_inBackground) return false;
+#endif
+    // Only a request the module hasn't answered can be sent again.  An error
+    // that shows up while the link is idle may be about something the module
+    // has already done, and doing it again (like restarting a track) is worse
+    // than reporting it.
+    if (!m_state.hasAny(State::EXPECT_ACK | State::EXPECT_ACK2 |
+                        State::EXPECT_RESPONSE)
+    ) {
+        return false;
+    }
+#if AIDTOPIA_SERIALAUDIO_TICKETS
+    if (m_sentTicket != NO_TICKET &&
+        m_tickets.status(m_sentTicket) != TicketStatus::SENT
+    ) {
+        return false;
+    }
+#endif
+    // Once the first ACK is in, the module has the command.
+    if (m_state.has(State::EXPECT_ACK2) && !m_state.has(State::EXPECT_ACK)) {
+        return false;
+    }
+    if (timedOut && !m_retryNonIdempotent && !isIdempotent(msgid)) {
+        return false;
+    }
+    if (m_attempts >= m_retryAttempts) {
+        // This one's done, so the next request starts with a full set of
+        // attempts, even if it's the same.
+        m_retrying = Command{Message::ID::NONE, 0, 0};
+        return false;
+    }
+    auto const cmd = Command{msgid, MSB(m_sentParam), LSB(m_sentParam)};
+    auto const ticket = m_sentTicket;
+    auto const queued = isQuery(msgid) ? m_queries.pushFront(cmd, ticket)
+                                       : m_commands.pushFront(cmd, ticket);
+    if (!queued) return false;
+    m_tickets.set(m_sentTicket, TicketStatus::PENDING);
+    m_retrying = cmd;
+    m_retryingTicket = ticket;
+    m_state = State{msgid, State::DELAY};
+    m_timeout.set(static_cast<uint16_t>(m_retryBackoff) << m_attempts,
+                  currentTime());
+    ++m_attempts;
+    m_stats.retry();
+    return true;
+}
+#endif
 
-void SerialAudio::stop() {
-    enqueue(Message::ID::STOP, State::EXPECT_ACK);
+Ticket SerialAudio::stop() {
+    return enqueue(Message::ID::STOP);
 }
 
-void SerialAudio::pause() {
-    enqueue(Message::ID::PAUSE, State::EXPECT_ACK);
+Ticket SerialAudio::pause() {
+    return enqueue(Message::ID::PAUSE);
 }
 
-void SerialAudio::unpause() {
-    enqueue(Message::ID::UNPAUSE, State::EXPECT_ACK);
+Ticket SerialAudio::unpause() {
+    return enqueue(Message::ID::UNPAUSE);
 }
 
-void SerialAudio::insertAdvert(uint16_t track) {
-    enqueue(Message::ID::INSERTADVERT, State::EXPECT_ACK, track);
+Ticket SerialAudio::insertAdvert(uint16_t track) {
+    return enqueue(Message::ID::INSERTADVERT, track);
 }
 
-void SerialAudio::insertAdvert(uint8_t folder, uint8_t track) {
+Ticket SerialAudio::insertAdvert(uint8_t folder, uint8_t track) {
     if (folder == 0) return insertAdvert(track);
-    enqueue(Message::ID::INSERTADVERTN, State::EXPECT_ACK,
-            combine(folder, track));
+    return enqueue(Message::ID::INSERTADVERTN, combine(folder, track));
 }
 
-void SerialAudio::stopAdvert() {
-    enqueue(Message::ID::STOPADVERT, State::EXPECT_ACK);
+Ticket SerialAudio::stopAdvert() {
+    return enqueue(Message::ID::STOPADVERT);
+}
+
+void SerialAudio::disableFeedback(CommandClass commands) {
+    m_noFeedback |= static_cast<uint8_t>(commands);
+}
+
+void SerialAudio::enableFeedback(CommandClass commands) {
+    m_noFeedback &= ~static_cast<uint8_t>(commands);
+}
+
+void SerialAudio::setMinimumGap(uint8_t gap) {
+    m_minimumGap = gap;
+}
+
+void SerialAudio::setFrameBudget(uint8_t frames) {
+    // Always make some progress.
+    m_frameBudget = frames > 0 ? frames : 1;
+}
+
+void SerialAudio::optimizeQueue(bool enable) {
+    m_optimize = enable;
+}
+
+void SerialAudio::setOverflowPolicy(OverflowPolicy policy) {
+    m_overflowPolicy = policy;
+}
+
+#if AIDTOPIA_SERIALAUDIO_RETRY
+void SerialAudio::setRetryPolicy(uint8_t attempts, uint8_t backoff,
+                                 bool nonIdempotent) {
+    m_retryAttempts = attempts;
+    m_retryBackoff = backoff;
+    m_retryNonIdempotent = nonIdempotent;
+}
+#endif
+
+#if AIDTOPIA_SERIALAUDIO_STATS
+ProtocolStats const &SerialAudio::stats() const {
+    return m_stats.snapshot(m_core.droppedFrames(), m_core.resyncs());
+}
+
+void SerialAudio::clearStats() {
+    m_stats.clear(m_core.droppedFrames(), m_core.resyncs());
+}
+#endif
+
+SerialAudio::State::Flag SerialAudio::expectations(Message::ID msgid) {
+    switch (msgid) {
+        // The module needs a moment after switching sources.
+        case Message::ID::SELECTSOURCE:
+            return State::EXPECT_ACK | State::DELAY;
+        // LOOPFOLDER ACKs twice when successful.
+        case Message::ID::LOOPFOLDER:
+            return State::EXPECT_ACK | State::EXPECT_ACK2;
+        default:
+            return isQuery(msgid) ? State::EXPECT_RESPONSE : State::EXPECT_ACK;
+    }
 }
 
 void SerialAudio::dispatch() {
     if (!m_state.ready()) return;
-    if (m_queue.empty()) return;
-    dispatch(m_queue.peekFront());
-    m_queue.popFront();
+    if (recheckDevice()) return;
+    // Commands go first, since they're usually what the user will hear.  But
+    // a steady stream of commands mustn't keep a query waiting forever.
+    if (m_commands.empty() ||
+        (!m_queries.empty() && m_commandStreak >= QUERY_STARVATION_LIMIT)
+    ) {
+        if (m_queries.empty()) return;
+        m_commandStreak = 0;
+        auto const &query = m_queries.peekFront();
+#if AIDTOPIA_SERIALAUDIO_FOLDER_INDEX
+        uint16_t value;
+        if (localAnswer(query, &value)) {
+            // Wait if `update` hasn't yet reported the previous answer.
+            if (m_answer.getID() != Message::ID::NONE) return;
+            m_answer = Message{query.msgid, value};
+            m_tickets.set(m_queries.ticket(0), TicketStatus::ACKED);
+            m_queries.popFront();
+            return;
+        }
+#endif
+        dispatch(query, m_queries.ticket(0));
+        m_queries.popFront();
+        return;
+    }
+    m_commandStreak = m_queries.empty() ? 0 : m_commandStreak + 1;
+    dispatch(m_commands.peekFront(), m_commands.ticket(0));
+    m_commands.popFront();
 }
 
-void SerialAudio::dispatch(Message::ID msgid, State::Flag flags, uint16_t data) {
-    dispatch(Command{State{msgid, flags}, data});
+void SerialAudio::dispatch(Command const &cmd, Ticket ticket) {
+#if AIDTOPIA_SERIALAUDIO_PLAYLIST
+    // Skip a combined play command whose playlist was cancelled while it
+    // waited.
+    if (cmd.msgid == Message::ID::PLAYLIST &&
+        (m_playlist == nullptr || !m_playlistOnModule)
+    ) {
+        m_tickets.set(ticket, TicketStatus::DROPPED);
+        return;
+    }
+#endif
+    if (!supports(cmd.msgid)) {
+        refuse(cmd.msgid);
+        m_tickets.set(ticket, TicketStatus::FAILED);
+        return;
+    }
+    dispatch(cmd.msgid, expectations(cmd.msgid), cmd.param(), ticket);
 }
 
-void SerialAudio::dispatch(Command const &cmd) {
+void SerialAudio::dispatch(
+    Message::ID msgid,
+    State::Flag flags,
+    uint16_t data,
+    Ticket ticket
+) {
+#if AIDTOPIA_SERIALAUDIO_RETRY
+    if (msgid != m_retrying.msgid || data != m_retrying.param() ||
+        ticket != m_retryingTicket
+    ) {
+        m_attempts = 0;
+        m_retrying = Command{Message::ID::NONE, 0, 0};
+    }
+#endif
+    m_state = State{msgid, flags};
+    m_sentParam = data;
+    m_sentTicket = ticket;
+    m_tickets.set(ticket, TicketStatus::SENT);
+#if AIDTOPIA_SERIALAUDIO_BACKGROUND_TASKS || AIDTOPIA_SERIALAUDIO_VARIANT_PROBE
+    m_inBackground = false;
+#endif
+#if AIDTOPIA_SERIALAUDIO_VARIANT_PROBE
+    m_probing = false;
+#endif
+    if (msgid == Message::ID::INSERTADVERT ||
+        msgid == Message::ID::INSERTADVERTN
+    ) {
+        m_advertPlaying = true;
+    }
+    if ((commandClass(msgid) & m_noFeedback) != 0 &&
+        !m_state.hasAny(State::DELAY | State::UNINITIALIZED)
+    ) {
+        // Instead of waiting for ACKs, just wait out the minimum gap.
+        m_state = State{msgid, State::DELAY};
+        // If too many go by without an answer, the oldest is forgotten.  Its
+        // ticket stays SENT, since the module never said.
+        if (m_unconfirmed.full()) m_unconfirmed.popFront();
+        m_unconfirmed.pushBack(Unconfirmed{msgid, ticket});
+    }
     auto const feedback =
-        cmd.state.has(State::EXPECT_ACK) ? Feedback::FEEDBACK :
-                                           Feedback::NO_FEEDBACK;
-    m_core.send(Message{cmd.state.sent(), cmd.param}, feedback);
-    m_state = cmd.state;
+        m_state.has(State::EXPECT_ACK) ? Feedback::FEEDBACK :
+                                         Feedback::NO_FEEDBACK;
+    auto const msg = Message{msgid, data};
+#if AIDTOPIA_SERIALAUDIO_PLAYLIST
+    if (msgid == Message::ID::PLAYLIST) {
+        uint8_t payload[MessageBuffer::MAX_DATA];
+        auto const size = m_playlist->modulePayload(payload, sizeof(payload));
+        m_core.send(msgid, payload, size, feedback);
+    } else {
+        m_core.send(msg, feedback);
+    }
+#else
+    m_core.send(msg, feedback);
+#endif
+    m_stats.sent(msgid);
+    m_mirror.sent(msg);
     unsigned const duration =
-        m_state.has(State::EXPECT_ACK)      ? 30  :
-        m_state.has(State::EXPECT_RESPONSE) ? 100 : 0;
-    m_timeout.set(duration);
+        m_state.hasAny(State::EXPECT_ACK | State::EXPECT_RESPONSE) ?
+            m_latency.timeout(static_cast<uint8_t>(msgid), defaultTimeout(msgid)) :
+        m_state.has(State::DELAY) ? m_minimumGap : 0;
+    startTimeout(duration);
+}
+
+void SerialAudio::startTimeout(unsigned duration) {
+    m_txTimeout = duration;
+    m_transmitting = true;
+    auto const now = currentTime();
+    m_timeout.set(TX_STAGING_LIMIT + duration, now);
+    checkTransmission(now);
+}
+
+void SerialAudio::checkTransmission(TimeRep now) {
+    if (!m_transmitting || m_core.sending()) return;
+    m_transmitting = false;
+    m_sentAt = now;
+    m_timeout.set(m_txTimeout, now);
+}
+
+uint8_t SerialAudio::pendingKey() const {
+    auto const key = static_cast<uint8_t>(m_state.sent());
+    if (m_state.hasAny(State::EXPECT_ACK | State::EXPECT_RESPONSE)) return key;
+    return key | SECOND_PHASE;
 }
 
-bool SerialAudio::enqueue(Message::ID msgid, State::Flag flags, uint16_t data) {
-    auto const cmd = Command{State{msgid, flags}, data};
-    if (!m_queue.pushBack(cmd)) {
-        Serial.println(F("*** Failed to enqueue command"));
+void SerialAudio::recordLatency(uint8_t key) {
+    m_timeout.cancel();
+    auto const ms = elapsed();
+    m_latency.record(key, ms);
+    if ((key & SECOND_PHASE) == 0) m_stats.latency(static_cast<Message::ID>(key), ms);
+    // A pending delay needs its timer, or nothing would ever end it.
+    if (m_state.has(State::DELAY)) m_timeout.set(300, currentTime());
+}
+
+uint16_t SerialAudio::elapsed() const {
+    auto const ms = m_now - m_sentAt;
+    return ms < 0xFFFF ? static_cast<uint16_t>(ms) : 0xFFFF;
+}
+
+#if AIDTOPIA_SERIALAUDIO_FOLDER_INDEX
+bool SerialAudio::localAnswer(Command const &cmd, uint16_t *value) const {
+    if (m_index == nullptr || m_mirror.isStale(ModuleMirror::DEVICE)) {
         return false;
     }
+    auto const device = m_mirror.device();
+    switch (cmd.msgid) {
+        case Message::ID::FOLDERCOUNT:
+            return m_index->folderCount(device, value);
+        case Message::ID::FOLDERFILECOUNT:
+            return m_index->fileCount(device, cmd.param(), value);
+        default:
+            return false;
+    }
+}
+#endif
+
+void SerialAudio::completeLocally(Hooks *hooks) {
+    if (m_answer.getID() == Message::ID::NONE) return;
+    if (hooks == nullptr) {
+        // Nobody to tell.
+    } else if (m_answer.getID() == Message::ID::ERROR) {
+        auto const msgid = static_cast<Message::ID>(m_answer.getParam());
+        hooks->handleError(Error::UNSUPPORTED, msgid);
+    } else {
+        auto const param = static_cast<Parameter>(m_answer.getID());
+        hooks->handleQueryResponse(param, m_answer.getParam());
+    }
+    m_answer = Message{};
+}
+
+bool SerialAudio::supports(Message::ID msgid) const {
+    auto const needs = capabilityFor(msgid);
+    auto const has = capabilityTable[static_cast<uint8_t>(m_variant)];
+    return (needs & has) == needs;
+}
+
+void SerialAudio::refuse(Message::ID msgid) {
+#if AIDTOPIA_SERIALAUDIO_PLAYLIST
+    // The items in a playlist are all the same kind, so none of them would
+    // play.
+    if (m_playlist != nullptr && m_playlist->current().getID() == msgid) {
+        m_playlist = nullptr;
+    }
+#endif
+    // If an earlier answer hasn't been reported yet, this one goes unreported.
+    if (m_answer.getID() != Message::ID::NONE) return;
+    m_answer = Message{Message::ID::ERROR, static_cast<uint16_t>(msgid)};
+}
+
+void SerialAudio::assumeVariant(Variant variant) {
+    m_variant = variant;
+#if AIDTOPIA_SERIALAUDIO_VARIANT_PROBE
+    m_probe = Probe::DONE;
+#endif
+}
+
+#if AIDTOPIA_SERIALAUDIO_VARIANT_PROBE
+// Asks the module to identify itself, but only when nothing else is waiting.
+// Like a background query, the probe yields to the sketch's requests and tries
+// again later.
+void SerialAudio::probeVariant(TimeRep now) {
+    if (m_probe == Probe::DONE || !m_state.ready()) return;
+    if (!m_commands.empty() || !m_queries.empty()) return;
+    if (m_answer.getID() != Message::ID::NONE) return;
+    if (static_cast<TimeRep>(now - m_lastRequest) < m_backgroundGuard) return;
+    auto const msgid = m_probe == Probe::FIRMWARE ?
+        Message::ID::FIRMWAREVERSION : Message::ID::CURRENTFLASHFILE;
+    dispatch(msgid, State::EXPECT_RESPONSE);
+    m_inBackground = true;
+    m_probing = true;
+}
+
+// `msg` is the response to the probe, or the error (including a timeout) that
+// took its place.
+void SerialAudio::identify(Message const &msg) {
+    m_probing = false;
+    if (m_probe == Probe::FIRMWARE) {
+        if (msg.getID() != Message::ID::FIRMWAREVERSION) {
+            // Catalex doesn't answer.  Check its other quirk to be sure.
+            m_probe = Probe::FLASHFILE;
+            return;
+        }
+        // The DFPlayer Mini reports version 8.  Other versions don't tell us
+        // enough to guess what the module can do.
+        if (msg.getParam() == 8) m_variant = Variant::DFPLAYER_MINI;
+    } else if (msg.getID() == Message::ID::CURRENTFLASHFILE &&
+               msg.getParam() == 256) {
+        // Catalex reports 256 regardless of what it's playing.
+        m_variant = Variant::CATALEX;
+    }
+    m_probe = Probe::DONE;
+}
+#endif
+
+#if AIDTOPIA_SERIALAUDIO_FOLDER_INDEX
+// Keeps the FolderIndex up to date with the counts the module reports.
+void SerialAudio::learn(Message const &msg) {
+    if (m_index == nullptr) return;
+    auto const count = msg.getParam();
+    switch (msg.getID()) {
+        case Message::ID::USBFILECOUNT:
+            m_index->setFingerprint(static_cast<uint8_t>(Device::USB), count);
+            return;
+        case Message::ID::SDFILECOUNT:
+            m_index->setFingerprint(static_cast<uint8_t>(Device::SDCARD), count);
+            return;
+        case Message::ID::FLASHFILECOUNT:
+            m_index->setFingerprint(static_cast<uint8_t>(Device::FLASH), count);
+            return;
+        default:
+            break;
+    }
+    if (m_mirror.isStale(ModuleMirror::DEVICE)) return;
+    auto const device = m_mirror.device();
+    switch (msg.getID()) {
+        case Message::ID::FOLDERCOUNT:
+            m_index->setFolderCount(device, count);
+            break;
+        case Message::ID::FOLDERFILECOUNT:
+            m_index->setFileCount(device, m_sentParam, count);
+            break;
+        default:
+            break;
+    }
+}
+#endif
+
+Ticket SerialAudio::enqueue(Message::ID msgid, uint16_t data) {
+#if AIDTOPIA_SERIALAUDIO_BACKGROUND_TASKS || AIDTOPIA_SERIALAUDIO_VARIANT_PROBE
+    m_lastRequest = currentTime();
+#endif
+#if AIDTOPIA_SERIALAUDIO_TRACE
+    if (auto *trace = m_core.trace()) {
+        trace->record(TraceRecord::REQUESTED, msgid, data);
+    }
+#endif
+#if AIDTOPIA_SERIALAUDIO_PLAYLIST || AIDTOPIA_SERIALAUDIO_CUE
+    if (msgid != Message::ID::PAUSE && msgid != Message::ID::UNPAUSE &&
+        (commandClass(msgid) & (static_cast<uint8_t>(CommandClass::TRANSPORT) |
+                                static_cast<uint8_t>(CommandClass::SEQUENCE))) != 0
+    ) {
+        // The sketch (or its cue) wants to play something else.
+#if AIDTOPIA_SERIALAUDIO_PLAYLIST
+        if (msgid != Message::ID::PLAYLIST) m_playlist = nullptr;
+#endif
+#if AIDTOPIA_SERIALAUDIO_CUE
+        if (!m_cueing) m_cue = nullptr;
+#endif
+    }
+#endif
+#if AIDTOPIA_SERIALAUDIO_BACKGROUND_TASKS || AIDTOPIA_SERIALAUDIO_VARIANT_PROBE
+    if (m_inBackground && m_state.has(State::EXPECT_RESPONSE)) {
+        // Don't make the sketch wait on a background query.  If the response
+        // shows up in the time the query had left, it'll be ignored.
+        m_abandoned = m_state.sent();
+        m_abandonedTicket = m_sentTicket;
+        m_abandonedTimeout.set(
+            m_latency.timeout(static_cast<uint8_t>(m_abandoned),
+                              defaultTimeout(m_abandoned)),
+            currentTime());
+        m_timeout.cancel();
+        m_state.clear(State::EXPECT_RESPONSE);
+        if (m_state.has(State::DELAY)) m_timeout.set(300, currentTime());
+    }
+#endif
+    if (m_optimize && coalesce(msgid, data)) {
+        // The command at the tail absorbed this one.
+        auto const ticket = m_commands.ticket(m_commands.size() - 1);
+        dispatch();
+        return ticket;
+    }
+    auto const cmd = Command{msgid, MSB(data), LSB(data)};
+    auto const ticket = m_tickets.issue();
+    auto const queued = isQuery(msgid) ? push(m_queries, cmd, ticket)
+                                       : push(m_commands, cmd, ticket);
+    if (!queued) m_tickets.set(ticket, TicketStatus::DROPPED);
+    m_stats.commands(m_commands.size());
+    m_stats.queries(m_queries.size());
     dispatch();
-    return true;
+    return ticket;
+}
+
+template <typename Lane>
+bool SerialAudio::push(Lane &lane, Command const &cmd, Ticket ticket) {
+    if (lane.full()) {
+        ++m_dropped;
+        switch (m_overflowPolicy) {
+            case OverflowPolicy::REJECT:
+#ifdef DEBUG
+                Serial.println(F("*** Failed to enqueue command"));
+#endif
+                return false;
+            case OverflowPolicy::DROP_OLDEST:
+                m_tickets.set(lane.ticket(0), TicketStatus::DROPPED);
+                lane.popFront();
+                break;
+            case OverflowPolicy::REPLACE_SAME_KIND: {
+                // The newest one of the same kind is the least likely to
+                // have been superseded by something queued after it.
+                auto i = lane.size();
+                while (i > 0 && lane[i - 1].msgid != cmd.msgid) --i;
+                if (i == 0) return false;
+                m_tickets.set(lane.ticket(i - 1), TicketStatus::DROPPED);
+                lane.removeAt(i - 1);
+                break;
+            }
+        }
+    }
+    return lane.pushBack(cmd, ticket);
+}
+
+// Rewrites the tail of the queue to account for a new command.  Returns true
+// if the new command was absorbed into one that's already queued.
+bool SerialAudio::coalesce(Message::ID msgid, uint16_t data) {
+    using ID = Message::ID;
+    switch (msgid) {
+        case ID::SETVOLUME:
+            // An absolute volume makes the volume changes just before it moot.
+            while (!m_commands.empty()) {
+                auto const tail = m_commands.back().msgid;
+                if (tail != ID::SETVOLUME && tail != ID::VOLUMEUP &&
+                    tail != ID::VOLUMEDOWN) break;
+                auto const last = m_commands.size() - 1;
+                m_tickets.set(m_commands.ticket(last), TicketStatus::DROPPED);
+                m_commands.removeAt(last);
+            }
+            return false;
+
+        case ID::VOLUMEUP:
+        case ID::VOLUMEDOWN: {
+            if (m_commands.empty()) return false;
+            auto &tail = m_commands.back();
+            if (tail.msgid != ID::SETVOLUME) return false;
+            auto const volume = tail.param();
+            if (msgid == ID::VOLUMEUP) {
+                if (volume < 30) tail.setParam(volume + 1);
+            } else {
+                if (volume > 0) tail.setParam(volume - 1);
+            }
+            return true;
+        }
+
+        case ID::STOP: {
+            // A track started just before a stop is moot.  Volume and EQ
+            // changes can be stepped over, but anything else (a sequence
+            // mode, an advert, a pause) may depend on what's playing when it
+            // arrives, so it's left alone along with everything before it.
+            auto i = m_commands.size();
+            while (i > 0) {
+                --i;
+                auto &cmd = m_commands[i];
+                auto const sent = cmd.msgid;
+                if (sent == ID::PLAYWITHVOLUME) {
+                    // Keep the volume change, but the request as the sketch
+                    // made it won't happen.  What's left goes out untracked,
+                    // like the commands the library sends on its own.
+                    m_tickets.set(m_commands.ticket(i), TicketStatus::DROPPED);
+                    m_commands.setTicket(i, NO_TICKET);
+                    cmd.msgid = ID::SETVOLUME;
+                    cmd.setParam(cmd.paramHi);
+                } else if (startsTrack(sent)) {
+                    m_tickets.set(m_commands.ticket(i), TicketStatus::DROPPED);
+                    m_commands.removeAt(i);
+                } else if ((commandClass(sent) &
+                            (static_cast<uint8_t>(CommandClass::VOLUME) |
+                             static_cast<uint8_t>(CommandClass::EQ))) == 0) {
+                    break;
+                }
+            }
+            return false;
+        }
+
+        case ID::PLAYFILE: {
+            // The module can set the volume and start a file in one frame,
+            // but only for the first 255 files.
+            if (m_commands.empty() || data > 0xFF) return false;
+            auto &tail = m_commands.back();
+            if (tail.msgid != ID::SETVOLUME) return false;
+            tail.msgid = ID::PLAYWITHVOLUME;
+            tail.setParam(combine(tail.paramLo, LSB(data)));
+            return true;
+        }
+
+        default:
+            return false;
+    }
 }
 
 void SerialAudio::onEvent(Message const &msg, Hooks *hooks) {
@@ -354,6 +1614,20 @@ void SerialAudio::onEvent(Message const &msg, Hooks *hooks) {
     if (m_state.has(State::UNINITIALIZED))    Serial.print(F(" | UNINITIALIZED"));
     Serial.println();
 #endif
+#if AIDTOPIA_SERIALAUDIO_BACKGROUND_TASKS || AIDTOPIA_SERIALAUDIO_VARIANT_PROBE
+    if (isQueryResponse(msg) && msg.getID() == m_abandoned &&
+        !(m_state.has(State::EXPECT_RESPONSE) && m_state.sent() == m_abandoned &&
+          m_sentTicket == m_abandonedTicket)
+    ) {
+        // This answers a background query we stopped waiting for.  The
+        // module answers in order, so it comes before the response to a
+        // request sent since, even the same query from the sketch.  It may
+        // predate the commands sent since, so even the mirror ignores it.
+        m_abandoned = Message::ID::NONE;
+        return;
+    }
+#endif
+    m_mirror.received(msg);
     handleEvent(msg, hooks);
     
     // We might be ready to dispatch a queued command now.
@@ -367,25 +1641,54 @@ void SerialAudio::handleEvent(Message const &msg, Hooks *hooks) {
         // TODO:  Consider what should happen if a device is inserted while
         // we're in an uninitialized or a no-sources state.
 
+#if AIDTOPIA_SERIALAUDIO_PLAYLIST || AIDTOPIA_SERIALAUDIO_CUE
+        switch (msg.getID()) {
+            case ID::FINISHEDUSBFILE:
+            case ID::FINISHEDSDFILE:
+            case ID::FINISHEDFLASHFILE:
+                onFinished(msg.getParam());
+                break;
+            default:
+                break;
+        }
+#endif
+#if AIDTOPIA_SERIALAUDIO_FOLDER_INDEX
+        if (m_index != nullptr && (msg.getID() == ID::DEVICEINSERTED ||
+                                   msg.getID() == ID::DEVICEREMOVED)) {
+            m_index->invalidate(LSB(msg.getParam()));
+        }
+#endif
+
+        auto const device = static_cast<Device>(msg.getParam());
+        switch (msg.getID()) {
+            case ID::DEVICEINSERTED:
+                // The module may need extra time right after a device is
+                // inserted.  If we're waiting on the module, the delay starts
+                // once it answers (see `recordLatency`).
+                m_state.set(State::DELAY);
+                if (!m_state.hasAny(State::EXPECT_ACK | State::EXPECT_ACK2 |
+                                    State::EXPECT_RESPONSE)) {
+                    m_timeout.set(300, currentTime());
+                }
+                // Then count its files to be sure it's usable.
+                if (m_expected.has(device)) m_toCheck.insert(device);
+                break;
+            case ID::DEVICEREMOVED:
+                m_available.remove(device);
+                m_toCheck.remove(device);
+                break;
+            default:
+                break;
+        }
+
         if (hooks != nullptr) {
             switch (msg.getID()) {
-                case ID::DEVICEINSERTED: {
-                    auto const device = static_cast<Device>(msg.getParam());
-                    // The module may need extra time right after a device is
-                    // inserted.
-                    m_state.set(State::DELAY);
-                    m_timeout.set(300);
-                    // TODO m_tocheck.insert(device);
+                case ID::DEVICEINSERTED:
                     hooks->handleDeviceChange(device, DeviceChange::INSERTED);
                     break;
-                }
-                case ID::DEVICEREMOVED: {
-                    auto const device = static_cast<Device>(msg.getParam());
-                    m_available.remove(device);
-                    // TODO m_tocheck.remove(device);
+                case ID::DEVICEREMOVED:
                     hooks->handleDeviceChange(device, DeviceChange::REMOVED);
                     break;
-                }
                 case ID::FINISHEDUSBFILE:
                     hooks->handleFinishedFile(Device::USB, msg.getParam());
                     break;
@@ -403,18 +1706,25 @@ void SerialAudio::handleEvent(Message const &msg, Hooks *hooks) {
     }
     
     if (isAck(msg)) {
+        confirmUnconfirmed();
         if (m_state.testAndClear(State::EXPECT_ACK)) {
-            m_timeout.cancel();
-            if (m_state.hasAny(State::EXPECT_ACK2 | State::DELAY)) {
-                m_timeout.set(300);
+            m_tickets.set(m_sentTicket, TicketStatus::ACKED);
+            recordLatency(static_cast<uint8_t>(m_state.sent()));
+            if (m_state.has(State::EXPECT_ACK2)) {
+                m_sentAt = m_now;
+                m_timeout.set(m_latency.timeout(pendingKey(), 300),
+                              currentTime());
+            } else if (m_state.has(State::DELAY)) {
+                m_timeout.set(300, currentTime());
             }
             return;
         }
         if (m_state.testAndClear(State::EXPECT_ACK2)) {
-            m_timeout.cancel();
+            recordLatency(static_cast<uint8_t>(m_state.sent()) | SECOND_PHASE);
             return;
         }
-        Serial.println(F("Unexpected ACK!"));
+        m_stats.unexpectedAck();
+        diagnose(F("Unexpected ACK!"));
         return;
     }
 
@@ -423,6 +1733,15 @@ void SerialAudio::handleEvent(Message const &msg, Hooks *hooks) {
             // Got INITCOMPLETE on power up
             m_state.clear(State::UNINITIALIZED);
             m_timeout.cancel();
+            m_available = Devices(LSB(msg.getParam()));
+#if AIDTOPIA_SERIALAUDIO_FOLDER_INDEX
+            if (m_index != nullptr && hooks != nullptr) {
+                // Check the index against the devices before reporting.
+                m_named = m_available;
+                dispatch(ID::STATUS, State::EXPECT_RESPONSE | State::UNINITIALIZED);
+                return;
+            }
+#endif
             if (hooks != nullptr) {
                 hooks->handleInitComplete(Devices(LSB(msg.getParam())));
             }
@@ -432,13 +1751,21 @@ void SerialAudio::handleEvent(Message const &msg, Hooks *hooks) {
             // Reset completed
             m_state.clear(State::UNINITIALIZED);
             m_timeout.cancel();
+            m_available = Devices(LSB(msg.getParam()));
+#if AIDTOPIA_SERIALAUDIO_FOLDER_INDEX
+            if (m_index != nullptr && hooks != nullptr) {
+                m_named = m_available;
+                dispatch(ID::STATUS, State::EXPECT_RESPONSE | State::UNINITIALIZED);
+                return;
+            }
+#endif
             if (hooks != nullptr) {
                 hooks->handleInitComplete(Devices(LSB(msg.getParam())));
             }
             return;
         }
         if (m_state.sent() == ID::INITCOMPLETE) {
-            Serial.println(F("OMG! INITCOMPLETE worked as a query!"));
+            diagnose(F("OMG! INITCOMPLETE worked as a query!"));
             m_state.clear(State::EXPECT_RESPONSE);
             m_timeout.cancel();
             if (hooks != nullptr) {
@@ -446,10 +1773,18 @@ void SerialAudio::handleEvent(Message const &msg, Hooks *hooks) {
             }
             return;
         }
-        Serial.println(F("Audio module unexpectedly reset!"));
-        m_state = State{Message:ID::NONE};
+        diagnose(F("Audio module unexpectedly reset!"));
+        dropRequests();
+        m_state = State{Message::ID::NONE};
         m_timeout.cancel();
-        m_queue.clear();
+        m_available = Devices(LSB(msg.getParam()));
+        m_toCheck.clear();
+#if AIDTOPIA_SERIALAUDIO_PLAYLIST
+        m_playlist = nullptr;
+#endif
+#if AIDTOPIA_SERIALAUDIO_CUE
+        m_cue = nullptr;
+#endif
         if (hooks != nullptr) {
             hooks->handleInitComplete(Devices(LSB(msg.getParam())));
         }
@@ -459,7 +1794,7 @@ void SerialAudio::handleEvent(Message const &msg, Hooks *hooks) {
     if (msg.getID() == ID::STATUS && m_state.has(State::UNINITIALIZED)) {
         // A response to a status query while we're uninitialized means we've
         // detected a live audio module after powerup.
-        m_timeout.cancel();
+        recordLatency(static_cast<uint8_t>(ID::STATUS));
         m_state.clear(State::EXPECT_RESPONSE);
         // The device given in the status message is currently selected, so
         // we'll assume it's available.
@@ -468,53 +1803,79 @@ void SerialAudio::handleEvent(Message const &msg, Hooks *hooks) {
         // If the client doesn't have hooks, there's no point in kicking off
         // device discovery.
         if (hooks == nullptr) {
+            m_named.clear();
             m_state.clear(State::UNINITIALIZED);
             return;
         }
         // We'll try to discover any other available devices before reporting
-        // that the module is initialized.
-        if (device != Device::USB)    m_state.set(State::CHECK_USB);
-        if (device != Device::SDCARD) m_state.set(State::CHECK_SD);
-        if (device != Device::FLASH)  m_state.set(State::CHECK_FLASH);
+        // that the module is initialized.  With an index, we also need the
+        // selected device's file count to check its fingerprint.  Devices the
+        // sketch doesn't expect, and (if INITCOMPLETE named the devices)
+        // those that aren't there, are skipped.
+#if AIDTOPIA_SERIALAUDIO_FOLDER_INDEX
+        auto const all = m_index != nullptr;
+#else
+        auto const all = false;
+#endif
+        for (auto const d : discoverable) {
+            if (!m_expected.has(d)) continue;
+            if (!m_named.empty() && !m_named.has(d)) continue;
+            if (all || d != device) {
+                m_state.set(checkFlag(fileCountQuery(d)));
+            }
+        }
+        if (!m_named.empty()) m_available |= m_named;
+        m_named.clear();
         if (continueDiscovery()) return;
         hooks->handleInitComplete(m_available);
         return;
     }
     
-    if (msg.getID() == ID::USBFILECOUNT && m_state.testAndClear(State::CHECK_USB)) {
-        m_state.clear(State::EXPECT_RESPONSE);
-        if (msg.getParam() > 0) m_available |= Device::USB;
-        if (continueDiscovery()) return;
-        if (hooks != nullptr) hooks->handleInitComplete(m_available);
-        return;
-    }
-
-    if (msg.getID() == ID::SDFILECOUNT && m_state.testAndClear(State::CHECK_SD)) {
+    if (checkFlag(msg.getID()) != State::NONE &&
+        m_state.testAndClear(checkFlag(msg.getID()))
+    ) {
+        recordLatency(static_cast<uint8_t>(msg.getID()));
         m_state.clear(State::EXPECT_RESPONSE);
-        if (msg.getParam() > 0) m_available |= Device::SDCARD;
-        if (continueDiscovery()) return;
-        if (hooks != nullptr) hooks->handleInitComplete(m_available);
-        return;
-    }
-
-    if (msg.getID() == ID::FLASHFILECOUNT && m_state.testAndClear(State::CHECK_FLASH)) {
-        m_state.clear(State::EXPECT_RESPONSE);
-        if (msg.getParam() > 0) m_available |= Device::FLASH;
-        if (continueDiscovery()) return;
-        if (hooks != nullptr) hooks->handleInitComplete(m_available);
+        auto const device = countedDevice(msg.getID());
+        if (msg.getParam() > 0) {
+            m_available |= device;
+        } else if (!m_state.has(State::UNINITIALIZED)) {
+            // An inserted device without any files is no use.
+            m_available.remove(device);
+        }
+#if AIDTOPIA_SERIALAUDIO_FOLDER_INDEX
+        learn(msg);
+#endif
+        finishCheck(hooks);
         return;
     }
 
     if (isQueryResponse(msg)) {
+        confirmUnconfirmed();
         if (!m_state.testAndClear(State::EXPECT_RESPONSE)) {
-            Serial.println(F("Got unexpected query response."));
+            m_stats.unexpectedResponse();
+            diagnose(F("Got unexpected query response."));
             return;
         }
         if (msg.getID() != m_state.sent()) {
-            Serial.println(F("Got query response for different query."));
+            m_stats.unexpectedResponse();
+            diagnose(F("Got query response for different query."));
             return;
         }
-        m_timeout.cancel();
+        recordLatency(static_cast<uint8_t>(msg.getID()));
+#if AIDTOPIA_SERIALAUDIO_VARIANT_PROBE
+        if (m_probing) {
+            identify(msg);
+            return;
+        }
+#endif
+        m_tickets.set(m_sentTicket, TicketStatus::ACKED);
+#if AIDTOPIA_SERIALAUDIO_FOLDER_INDEX
+        learn(msg);
+#endif
+#if AIDTOPIA_SERIALAUDIO_PLAYLIST || AIDTOPIA_SERIALAUDIO_CUE
+        if (msg.getID() == ID::STATUS) checkPlaylistStopped(msg);
+#endif
         if (hooks != nullptr) {
             auto const param = static_cast<Parameter>(msg.getID());
             hooks->handleQueryResponse(param, msg.getParam());
@@ -522,8 +1883,22 @@ void SerialAudio::handleEvent(Message const &msg, Hooks *hooks) {
         return;
     }
     
-    if (isTimeout(msg)) {
-        if (m_state.testAndClear(State::DELAY)) {
+    if (isTimeout(msg) && m_transmitting) {
+        // The frame never got out of the serial port, so this says nothing
+        // about how long the module takes.
+        m_transmitting = false;
+    } else if (isTimeout(msg)) {
+        if (m_state.hasAny(State::EXPECT_ACK | State::EXPECT_ACK2 |
+                           State::EXPECT_RESPONSE)) {
+            m_stats.timeout();
+            // Make the next wait for this message long enough.
+            m_latency.backoff(pendingKey(), elapsed());
+        }
+        // A delay ends quietly, but not if the module also failed to answer.
+        if (!m_state.hasAny(State::EXPECT_ACK | State::EXPECT_ACK2 |
+                            State::EXPECT_RESPONSE) &&
+            m_state.testAndClear(State::DELAY)
+        ) {
             m_timeout.cancel();
             return;
         }
@@ -545,18 +1920,125 @@ void SerialAudio::handleEvent(Message const &msg, Hooks *hooks) {
         return;
     }
     
+    if (isError(msg) && !isTimeout(msg) && !m_unconfirmed.empty()) {
+        // An error that arrives while commands sent without feedback are
+        // outstanding is taken to be about one of them.  If it was about the
+        // current request instead, its ACK or response won't come, and the
+        // timeout will catch that.  Either way, keep waiting (or keep
+        // observing the gap).
+        rejectUnconfirmed(msg, hooks);
+        return;
+    }
+
     if (isError(msg)) {
+        m_unconfirmed.clear();
         m_timeout.cancel();
+#if AIDTOPIA_SERIALAUDIO_VARIANT_PROBE
+        if (m_probing) {
+            m_state.clear(State::ALL_FLAGS);
+            identify(msg);
+            return;
+        }
+#endif
+#if AIDTOPIA_SERIALAUDIO_BACKGROUND_TASKS || AIDTOPIA_SERIALAUDIO_VARIANT_PROBE
+        if (m_inBackground) {
+            // The sketch didn't ask for it, so it doesn't hear about it.  The
+            // query will run again next period.
+            m_state.clear(State::ALL_FLAGS);
+            m_stats.backgroundFailure();
+            return;
+        }
+#endif
+        if (checkFlag(m_state.sent()) != State::NONE &&
+            m_state.testAndClear(checkFlag(m_state.sent()))
+        ) {
+            // A device that can't count its files isn't there.  Move on.
+            m_state.clear(State::EXPECT_RESPONSE);
+            finishCheck(hooks);
+            return;
+        }
+#if AIDTOPIA_SERIALAUDIO_RETRY
+        if (retry(msg)) return;
+#endif
+        auto status = TicketStatus::FAILED;
+        if (isTimeout(msg)) status = TicketStatus::TIMEDOUT;
+        m_tickets.set(m_sentTicket, status);
         m_state.clear(State::ALL_FLAGS);
+        m_mirror.rejected(m_state.sent());
+        if (m_state.sent() == ID::INSERTADVERT ||
+            m_state.sent() == ID::INSERTADVERTN
+        ) {
+            m_advertPlaying = false;
+        }
+        // A module that doesn't know the combined play command may just not
+        // answer, so a timeout counts as a rejection, too.  Either way, the
+        // sketch doesn't need to hear about it.
+#if AIDTOPIA_SERIALAUDIO_PLAYLIST
+        if (takeOverFromModule(m_state.sent())) return;
+#endif
         if (hooks != nullptr) {
             auto const code = static_cast<SerialAudio::Error>(msg.getParam());
             hooks->handleError(code, m_state.sent());
         }
+#if AIDTOPIA_SERIALAUDIO_PLAYLIST
+        // A timeout doesn't mean the item didn't start.
+        if (m_playlist != nullptr && !isTimeout(msg)) skipFailedItem();
+#endif
         return;
     }
 }
 
+// The module handles messages in order, so once it answers a later request,
+// any error for a command sent without feedback would have arrived already.
+void SerialAudio::confirmUnconfirmed() {
+    while (!m_unconfirmed.empty()) {
+        m_tickets.set(m_unconfirmed.peekFront().ticket, TicketStatus::ACKED);
+        m_unconfirmed.popFront();
+    }
+}
+
+// A command that succeeds without feedback says nothing, so when several are
+// outstanding, there's no telling which one an error is about.  Then the error
+// is reported without a message ID, the local copy forgets whatever any of
+// them would have changed, and their tickets stay SENT.
+void SerialAudio::rejectUnconfirmed(Message const &error, Hooks *hooks) {
+    auto msgid = Message::ID::NONE;
+    if (m_unconfirmed.size() == 1) {
+        auto const &cmd = m_unconfirmed.peekFront();
+        msgid = cmd.msgid;
+        m_tickets.set(cmd.ticket, TicketStatus::FAILED);
+        m_mirror.rejected(msgid);
+        if (msgid == Message::ID::INSERTADVERT ||
+            msgid == Message::ID::INSERTADVERTN
+        ) {
+            m_advertPlaying = false;
+        }
+    } else {
+        for (uint8_t i = 0; i < m_unconfirmed.size(); ++i) {
+            m_mirror.rejected(m_unconfirmed[i].msgid);
+        }
+    }
+    m_unconfirmed.clear();
+#if AIDTOPIA_SERIALAUDIO_PLAYLIST
+    if (takeOverFromModule(msgid)) return;
+#endif
+    if (hooks != nullptr) {
+        auto const code = static_cast<SerialAudio::Error>(error.getParam());
+        hooks->handleError(code, msgid);
+    }
+}
+
 bool SerialAudio::continueDiscovery() {
+    // Without an index to fingerprint, there's no need to keep looking once
+    // every expected device has turned up.
+    auto const expected = m_expected.bitmask();
+    auto fingerprinting = false;
+#if AIDTOPIA_SERIALAUDIO_FOLDER_INDEX
+    fingerprinting = m_index != nullptr;
+#endif
+    if (!fingerprinting && (m_available.bitmask() & expected) == expected) {
+        m_state.clear(State::DISCOVERY_FLAGS);
+    }
     if (m_state.has(State::CHECK_USB)) {
         dispatch(Message::ID::USBFILECOUNT, m_state.flags() | State::EXPECT_RESPONSE);
         return true;
@@ -573,6 +2055,52 @@ bool SerialAudio::continueDiscovery() {
     return false;
 }
 
+// After a device check, moves on to the next one.  If the checks were part of
+// initialization, reports when it's complete.
+void SerialAudio::finishCheck(Hooks *hooks) {
+    auto const initializing = m_state.has(State::UNINITIALIZED);
+    if (continueDiscovery()) return;
+    if (initializing && hooks != nullptr) hooks->handleInitComplete(m_available);
+}
+
+// Counts the files on a device inserted since initialization, rather than
+// rediscovering all of them.  Returns true if it sent a query.
+bool SerialAudio::recheckDevice() {
+    for (auto const d : discoverable) {
+        if (!m_toCheck.has(d)) continue;
+        m_toCheck.remove(d);
+        auto const msgid = fileCountQuery(d);
+        dispatch(msgid, State::EXPECT_RESPONSE | checkFlag(msgid));
+        return true;
+    }
+    return false;
+}
+
+SerialAudio::State::Flag SerialAudio::checkFlag(Message::ID msgid) {
+    switch (msgid) {
+        case Message::ID::USBFILECOUNT:   return State::CHECK_USB;
+        case Message::ID::SDFILECOUNT:    return State::CHECK_SD;
+        case Message::ID::FLASHFILECOUNT: return State::CHECK_FLASH;
+        default:                          return State::NONE;
+    }
+}
+
+// Empties both lanes.  The queued requests, and the one in flight if the
+// module hasn't answered it, will never finish.
+void SerialAudio::dropRequests() {
+    while (!m_commands.empty()) {
+        m_tickets.set(m_commands.ticket(0), TicketStatus::DROPPED);
+        m_commands.popFront();
+    }
+    while (!m_queries.empty()) {
+        m_tickets.set(m_queries.ticket(0), TicketStatus::DROPPED);
+        m_queries.popFront();
+    }
+    if (m_state.hasAny(State::EXPECT_ACK | State::EXPECT_RESPONSE)) {
+        m_tickets.set(m_sentTicket, TicketStatus::DROPPED);
+    }
+}
+
 void SerialAudio::onPowerUp() {
     // I used to just hit the module with a reset command on powerup, but
     // documentation and experience suggests that the device might not tolerate
@@ -580,9 +2108,18 @@ void SerialAudio::onPowerUp() {
     // up and wait for an initialization complete (0x3F) notification.  If one
     // doesn't come, the state machine will fall back to figuring out whether
     // the module is already online and which devices are attached.
-    m_queue.clear();
+    dropRequests();
+#if AIDTOPIA_SERIALAUDIO_PLAYLIST
+    m_playlist = nullptr;
+#endif
+#if AIDTOPIA_SERIALAUDIO_CUE
+    m_cue = nullptr;
+#endif
+    m_named.clear();
+    m_toCheck.clear();
     m_state = State();
-    m_timeout.set(3000);
+    m_transmitting = false;
+    m_timeout.set(3000, currentTime());
 }
 
 }
@@ -7,10 +7,111 @@
 #ifndef AIDTOPIASERIALAUDIO_H
 #define AIDTOPIASERIALAUDIO_H
 
+#include "utilities/background.h"
+#include "utilities/busy.h"
 #include "utilities/core.h"
+#include "utilities/cue.h"
+#include "utilities/folderindex.h"
+#include "utilities/latency.h"
+#include "utilities/mirror.h"
+#include "utilities/playlist.h"
 #include "utilities/queue.h"
+#include "utilities/stats.h"
 #include "utilities/message.h"
+#include "utilities/tickets.h"
 #include "utilities/timeout.h"
+#include "utilities/trace.h"
+
+// The number of commands and queries that can wait to be sent.  Each slot
+// costs three bytes of RAM, plus one for its ticket unless tickets are turned
+// off.  Both must be powers of two.  The defaults take 36 bytes (48 with
+// tickets), where the old single queue of four commands took 16.  To come
+// close to that, use a depth of 4 for commands and 2 for queries, and turn
+// tickets off.
+#ifndef AIDTOPIA_SERIALAUDIO_COMMAND_QUEUE_DEPTH
+#define AIDTOPIA_SERIALAUDIO_COMMAND_QUEUE_DEPTH 8
+#endif
+#ifndef AIDTOPIA_SERIALAUDIO_QUERY_QUEUE_DEPTH
+#define AIDTOPIA_SERIALAUDIO_QUERY_QUEUE_DEPTH 4
+#endif
+
+// The number of events that can wait for `pollEvents` when events are
+// deferred.  Each costs four bytes of RAM.  Must be a power of two, or 0 to
+// leave out deferred events (`deferEvents` and `pollEvents`).
+#ifndef AIDTOPIA_SERIALAUDIO_EVENT_QUEUE_DEPTH
+#define AIDTOPIA_SERIALAUDIO_EVENT_QUEUE_DEPTH 0
+#endif
+
+// The number of recent requests whose status can be looked up by ticket (see
+// `ticketStatus`).  Each costs two bytes of RAM.  Must be a power of two.
+// Set it to 0 to do without tickets, so that the queues needn't remember a
+// ticket for each request.  Every status is then UNKNOWN, and a cue's
+// WAIT_FINISHED can't tell its own track from one that was already playing.
+#ifndef AIDTOPIA_SERIALAUDIO_TICKETS
+#define AIDTOPIA_SERIALAUDIO_TICKETS 16
+#endif
+
+// The number of background queries (see `addBackgroundQuery`).  0 leaves out
+// background queries altogether.
+#ifndef AIDTOPIA_SERIALAUDIO_BACKGROUND_TASKS
+#define AIDTOPIA_SERIALAUDIO_BACKGROUND_TASKS 0
+#endif
+
+// The clock for timeouts and timestamps:  a class with a static `now` that
+// returns an unsigned count of milliseconds, like MillisClock.  A simulation
+// can substitute a narrower clock to make rollover come sooner (see
+// extras/host/soak.cpp).
+#ifndef AIDTOPIA_SERIALAUDIO_CLOCK
+#define AIDTOPIA_SERIALAUDIO_CLOCK aidtopia::MillisClock
+#endif
+
+// Set to 0 to drop the diagnostic messages the library prints on `Serial`
+// (like "Unexpected ACK!").  Then a sketch that doesn't use `Serial` itself
+// doesn't link it in, which saves its buffers.
+#ifndef AIDTOPIA_SERIALAUDIO_DIAGNOSTICS
+#define AIDTOPIA_SERIALAUDIO_DIAGNOSTICS 1
+#endif
+
+// Set to 0 to leave out support for the BUSY line (`useBusySource`).
+#ifndef AIDTOPIA_SERIALAUDIO_BUSY
+#define AIDTOPIA_SERIALAUDIO_BUSY 1
+#endif
+
+// The rest of the features are off unless the build turns them on.  The
+// library's own source files must see the same settings as the sketch, so
+// pass them as compiler flags (see extras/footprint.md) rather than defining
+// them in the sketch.
+
+// Set to 1 for playlists (`play` and `playOnModule`).
+#ifndef AIDTOPIA_SERIALAUDIO_PLAYLIST
+#define AIDTOPIA_SERIALAUDIO_PLAYLIST 0
+#endif
+
+// Set to 1 for cues (`runCue`).
+#ifndef AIDTOPIA_SERIALAUDIO_CUE
+#define AIDTOPIA_SERIALAUDIO_CUE 0
+#endif
+
+// Set to 1 for a FolderIndex (`useIndex`).  It needs the mirror, to know
+// which device is selected.
+#ifndef AIDTOPIA_SERIALAUDIO_FOLDER_INDEX
+#define AIDTOPIA_SERIALAUDIO_FOLDER_INDEX 0
+#endif
+#if AIDTOPIA_SERIALAUDIO_FOLDER_INDEX && !AIDTOPIA_SERIALAUDIO_MIRROR
+#error "AIDTOPIA_SERIALAUDIO_FOLDER_INDEX needs AIDTOPIA_SERIALAUDIO_MIRROR"
+#endif
+
+// Set to 1 for the queries that tell which kind of module is attached.
+// Otherwise, the variant is UNKNOWN unless the sketch calls `assumeVariant`.
+#ifndef AIDTOPIA_SERIALAUDIO_VARIANT_PROBE
+#define AIDTOPIA_SERIALAUDIO_VARIANT_PROBE 0
+#endif
+
+// Set to 0 to leave out retries (`setRetryPolicy`).  An unanswered or garbled
+// request is then reported to the hooks right away.
+#ifndef AIDTOPIA_SERIALAUDIO_RETRY
+#define AIDTOPIA_SERIALAUDIO_RETRY 1
+#endif
 
 namespace aidtopia {
 
@@ -45,6 +146,7 @@ class SerialAudio {
                 void clear();
                 void insert(Device device);
                 void remove(Device device);
+                uint8_t bitmask() const;
             private:
                 uint8_t m_bitmask;
         };
@@ -107,6 +209,16 @@ class SerialAudio {
             TIMEDOUT           = 0x0100
         };
 
+        // Groups of commands that can be sent without feedback.  (See
+        // `disableFeedback`.)
+        enum class CommandClass : uint8_t {
+            TRANSPORT   = 0x01,  // play, stop, pause, unpause, next, previous
+            VOLUME      = 0x02,  // setVolume, increaseVolume, decreaseVolume
+            EQ          = 0x04,  // setEqProfile
+            SEQUENCE    = 0x08,  // the looping and random play commands
+            ADVERT      = 0x10   // insertAdvert, stopAdvert
+        };
+
         // Client must call `begin` before anything else, typically in `setup`.
         // `SerialType` should be an instance of `HardwareSerial` or
         // `SoftwareSerial`.
@@ -117,6 +229,16 @@ class SerialAudio {
             // the audio module has just powered up as well.
             onPowerUp();
         }
+
+        // If the module doesn't announce itself at power-up, the library
+        // counts the files on each kind of storage device to see which are
+        // there.  Asking about a device the board can't have wastes time, so
+        // if you know which ones it can (a Catalex only takes an SD card),
+        // call this before `begin`.  The default is all three.
+        void setExpectedDevices(Devices devices) { m_expected = devices; }
+
+        // The devices found at initialization, updated as they come and go.
+        Devices availableDevices() const { return m_available; }
         
         // Client should call `update` frequently, typically each pass through
         // the `loop` function.
@@ -148,6 +270,9 @@ class SerialAudio {
                 void handleDeviceChange(Device src, DeviceChange change);
                 void handleFinishedFile(Device device, uint16_t index);
                 void handleInitComplete(Devices devices);
+                void handleTrackStarted();
+                void handleTrackEnded();
+                void handleAdvertFinished();
 
             private:
                 // Provide overrides for any or all of these methods.
@@ -159,10 +284,21 @@ class SerialAudio {
                 virtual void onFinishedFile(Device device, uint16_t index);
                 virtual void onInitComplete(Devices devices);
 
+                // From the BUSY line (see `useBusySource`).  A track "ends"
+                // whenever playback stops, including when the sketch stops
+                // or pauses it.
+                virtual void onTrackStarted();
+                virtual void onTrackEnded();
+                virtual void onAdvertFinished();
+
             private:
                 // For filtering duplicate asynchronous notifications.
                 Device m_deviceLastFinished;
                 uint16_t m_indexLastFinished;
+
+                // Deferred events have already been filtered, so they're
+                // delivered straight to the virtual methods.
+                friend class SerialAudio;
         };
 
         bool update(Hooks *hooks);
@@ -172,6 +308,59 @@ class SerialAudio {
         // reference.
         bool update(Hooks &hooks);
 
+        // When a single sketch services several modules, it can read the
+        // clock once and pass the time to each module's `update`.  (See
+        // SerialAudioGroup.)
+        using Clock = AIDTOPIA_SERIALAUDIO_CLOCK;
+        using TimeRep = Timeout<Clock>::TimeRep;
+        bool update(Hooks *hooks, TimeRep now);
+
+        // Each `update` handles every complete message that has already
+        // arrived, up to a budget of `frames`, so that a burst from the module
+        // (e.g., an ACK, a response, and a notification) doesn't linger in
+        // the serial buffer until the next pass through `loop`.  The default
+        // budget is 4.
+        void setFrameBudget(uint8_t frames);
+
+        // The number of received bytes not yet handled, and the number of
+        // frames discarded because they were corrupted.
+        int backlog() const { return m_core.backlog(); }
+        uint16_t droppedFrames() const { return m_core.droppedFrames(); }
+
+        // Records every frame sent and received, and every request the
+        // sketch makes, with a timestamp in microseconds.  It's much cheaper
+        // than printing them (as the DEBUG build does), so it doesn't disturb
+        // the timing.  Dump the trace when something goes wrong, and
+        // extras/host/replay.cpp can play it back on a desktop.  Pass nullptr
+        // to stop recording.
+        //
+        //     aidtopia::TraceBuffer<64> trace;
+        //     ...
+        //     audio.useTrace(&trace);
+        //     ...
+        //     trace.dump(Serial);
+#if AIDTOPIA_SERIALAUDIO_TRACE
+        void useTrace(Trace *trace) { m_core.useTrace(trace); }
+#endif
+
+#if AIDTOPIA_SERIALAUDIO_EVENT_QUEUE_DEPTH
+        // Normally `update` calls the hooks the moment something happens,
+        // which may be in the middle of an exchange with the module.  A slow
+        // hook (like one that redraws a display) then eats into the time the
+        // protocol has to respond.
+        //
+        // When events are deferred, `update` instead records them in a small
+        // ring, and the sketch delivers them by calling `pollEvents` when it's
+        // convenient.  The hooks passed to `update` are ignored.  If the ring
+        // fills, new events are discarded and counted.
+        void deferEvents(bool defer);
+
+        // Delivers up to `limit` deferred events, oldest first.  Returns the
+        // number delivered.
+        uint8_t pollEvents(Hooks &hooks, uint8_t limit = 0xFF);
+        uint16_t droppedEvents() const { return m_events.dropped(); }
+#endif
+
         // These are the commands and queries the client can use to control the
         // audio module.
         //
@@ -186,49 +375,215 @@ class SerialAudio {
         // first, and provide an onFileFinished hook that plays the next song
         // in the list.  Another option is to place the sounds in a numbered
         // folder and use the `loopFolder` command.
-        void reset();
-        void queryFirmwareVersion();
-        void queryFileCount(Device device);
-        void selectSource(Device source);
-        void queryStatus();
+        //
+        // Each returns a Ticket, which the sketch can use to find out what
+        // became of that particular request, rather than sorting it out from
+        // the hooks.  The status moves from PENDING to SENT, and then to
+        // ACKED (for a query, when the answer arrives), FAILED, or TIMEDOUT.
+        // A request that never reaches the module, because the queue was full
+        // or a reset cleared it, is DROPPED.  A request that's combined with
+        // one already waiting (see `optimizeQueue`) shares that one's ticket.
+        // A command sent without feedback (see `disableFeedback`) stays SENT
+        // unless the module reports an error or acknowledges the next command.
+        // The library remembers only the last AIDTOPIA_SERIALAUDIO_TICKETS
+        // tickets; older ones are UNKNOWN.  The methods return NO_TICKET when
+        // the request isn't made at all.
+        //
+        // Tickets are optional.  A sketch that ignores them can turn them off
+        // to save RAM (see AIDTOPIA_SERIALAUDIO_TICKETS).
+        using Ticket = aidtopia::Ticket;
+        using TicketStatus = aidtopia::TicketStatus;
+        TicketStatus ticketStatus(Ticket ticket) const {
+            return m_tickets.status(ticket);
+        }
+
+        Ticket reset();
+        Ticket queryFirmwareVersion();
+        Ticket queryFileCount(Device device);
+        Ticket selectSource(Device source);
+        Ticket queryStatus();
 
         // Volume ranges from 0 to 30.
-        void setVolume(uint8_t volume);
-        void increaseVolume();
-        void decreaseVolume();
-        void queryVolume();
+        Ticket setVolume(uint8_t volume);
+        Ticket increaseVolume();
+        Ticket decreaseVolume();
+        Ticket queryVolume();
 
-        void setEqProfile(EqProfile eq);
-        void queryEqProfile();
+        Ticket setEqProfile(EqProfile eq);
+        Ticket queryEqProfile();
 
         // Methods with "File" refer to sound files by their file system index.
-        void playFile(uint16_t index);
-        void playNextFile();
-        void playPreviousFile();
-        void loopFile(uint16_t index);
-        void loopAllFiles();
-        void playFilesInRandomOrder();
-        void queryCurrentFile(Device device);
+        Ticket playFile(uint16_t index);
+        Ticket playNextFile();
+        Ticket playPreviousFile();
+        Ticket loopFile(uint16_t index);
+        Ticket loopAllFiles();
+        Ticket playFilesInRandomOrder();
+        Ticket queryCurrentFile(Device device);
 
         // Methods that use folder numbers refer to the folder name's numeric
         // prefix.
-        void queryFolderCount();
-        void queryFolderFileCount(uint16_t folder);
-        void loopFolder(uint16_t folder);
+        Ticket queryFolderCount();
+        Ticket queryFolderFileCount(uint16_t folder);
+        Ticket loopFolder(uint16_t folder);
+
+        // Counting folders and files can take the module a long time.  With a
+        // FolderIndex attached, the library remembers the counts (across
+        // boots, if the index has storage) and answers queryFolderCount and
+        // queryFolderFileCount for the selected device without asking the
+        // module.  Each time the module initializes, the library checks every
+        // device's total file count against the index.  A device's entry is
+        // also discarded when it's inserted or removed.  Attach the index
+        // before calling `begin`.
+#if AIDTOPIA_SERIALAUDIO_FOLDER_INDEX
+        void useIndex(FolderIndex &index);
+#endif
 
         // Methods with "Track" refer to sounds files by the file name's prefix.
-        void playTrack(uint16_t track);  // from "MP3" folder
-        void playTrack(uint16_t folder, uint16_t track);
+        Ticket playTrack(uint16_t track);  // from "MP3" folder
+        Ticket playTrack(uint16_t folder, uint16_t track);
 
         // Control whether the currently playing track should loop.
-        void loopCurrentTrack();
-        void stopLoopingCurrentTrack();
+        Ticket loopCurrentTrack();
+        Ticket stopLoopingCurrentTrack();
+
+        Ticket queryPlaybackSequence();
+
+        // Plays the items of a Playlist one after another.  When the module
+        // reports that an item has finished, the library sends the command
+        // for the next one right away, ahead of anything else that's waiting,
+        // without a trip through the hooks.  (The hooks still hear about each
+        // finished file.)  If the module rejects an item, it's skipped.
+        //
+        // The playlist ends after its last item (unless it repeats), or when
+        // the sketch uses `stop`, `reset`, or any other command that starts
+        // playback.  Pausing doesn't end it.  The Playlist must outlive its
+        // use.
+        //
+        // If a FINISHED notification is lost, the playlist would wait
+        // forever.  To guard against that, poll the status in the background
+        // (see `addBackgroundQuery`).  When two status reports in a row say
+        // the module has stopped, the library moves on to the next item.
+        //
+        // The ticket is for the first item.  The rest don't get tickets.  An
+        // empty Playlist isn't played, and gets NO_TICKET.
+#if AIDTOPIA_SERIALAUDIO_PLAYLIST
+        using Playlist = aidtopia::Playlist;
+        Ticket play(Playlist &playlist);
+        bool playingPlaylist() const { return m_playlist != nullptr; }
 
-        void queryPlaybackSequence();
+        // Hands a short playlist to the module, which plays the items by
+        // itself (with its combined play command, 0x21), so nothing has to
+        // be sent between them.  Only a playlist of tracks in a numbered
+        // folder qualifies, and only if it neither shuffles nor repeats and
+        // it fits in one message (AIDTOPIA_SERIALAUDIO_MAX_DATA / 2 items).
+        // Other playlists, and any playlist on a module that rejects the
+        // command, are played just like `play`.
+        Ticket playOnModule(Playlist &playlist);
+#endif
+
+        // Runs a Cue's script from the top.  The library sends each step's
+        // command itself and moves on when the step is done, so a sequence
+        // like "play, wait for it to finish, insert an advert, fade out"
+        // needs no hooks.  WAIT_FINISHED ends when the module reports that
+        // the cue's last play command has finished (or, with a BUSY source,
+        // when BUSY says so), or right away if the module rejected that
+        // command.  As with a playlist, background status queries guard
+        // against a lost FINISHED notification.
+        //
+        // One cue runs at a time.  It ends at its END step, or when the
+        // sketch uses `stopCue`, `reset`, or any command that starts
+        // playback (including playing a Playlist).  Pausing doesn't end it,
+        // but its timers keep running.  The Cue must outlive its use.
+#if AIDTOPIA_SERIALAUDIO_CUE
+        using Cue = aidtopia::Cue;
+        void runCue(Cue &cue);
+        void stopCue() { m_cue = nullptr; }
+        bool runningCue() const { return m_cue != nullptr; }
+#endif
+
+        // If the module's BUSY output is wired to the Arduino, the library can
+        // use it to tell when playback starts and stops within a millisecond
+        // or so, rather than waiting for the FINISHED notification, which
+        // arrives late and often twice.  The hooks hear about it through
+        // `onTrackStarted` and `onTrackEnded`.  BUSY is also the only way to
+        // know when an advert has finished (`onAdvertFinished`), since the
+        // protocol has no notification for that.  While a Playlist is
+        // playing, the next item starts as soon as BUSY says the current one
+        // has ended.
+        //
+        // See utilities/busy.h for BusyPin and BusyInterruptPin.  Pass
+        // nullptr to stop using it.
+#if AIDTOPIA_SERIALAUDIO_BUSY
+        void useBusySource(BusySource *busy);
+#endif
+
+        // Modules differ in which commands they support, and a module that
+        // doesn't support one may not say so, which costs a timeout.  Once
+        // the module is up and the link is idle, the library asks it a
+        // question or two to tell which kind it is.  After that, requests the
+        // module can't handle fail right away with Error::UNSUPPORTED, and
+        // `playOnModule` falls back to `play` when the module can't take the
+        // whole playlist.  Until then, the variant is UNKNOWN, and everything
+        // is sent to the module.
+        //
+        // If you know which module you have, `assumeVariant` skips the probe.
+        enum class Variant : uint8_t {
+            UNKNOWN,
+            DFPLAYER_MINI,
+            CATALEX,
+            CLONE           // does less than a DFPlayer Mini (set it with assumeVariant)
+        };
+        Variant variant() const { return m_variant; }
+        void assumeVariant(Variant variant);
 
-        void stop();
-        void pause();
-        void unpause();
+#if AIDTOPIA_SERIALAUDIO_MIRROR
+        // The library keeps a local copy of the module's volume, EQ profile,
+        // playback sequence, and status, so a sketch can check them without
+        // waiting for a query.  The copy is updated as commands are sent and
+        // as responses and notifications arrive.
+        //
+        // A value is stale when the library can't vouch for it:  before it's
+        // been set or queried, after a reset, after the module rejects a
+        // command that would have changed it, or (for the status) after a
+        // track finishes or a device comes or goes.  Use `refresh` to have the
+        // module confirm a value.  The response updates the copy and is also
+        // reported to `Hooks::onQueryResponse`.
+        uint8_t volume() const;
+        EqProfile eqProfile() const;
+        Sequence playbackSequence() const;
+        ModuleState moduleState() const;
+        Device selectedDevice() const;
+        bool isStale(Parameter param) const;
+        Ticket refresh(Parameter param);
+#endif
+
+        // Background queries keep the local copy (or the sketch's own, through
+        // the hooks) up to date while the link is otherwise idle.  Each
+        // repeats every `period` milliseconds, but only when nothing else is
+        // waiting to be sent and no command or query has been requested
+        // within the guard interval (100 ms by default).  If the sketch
+        // requests something while a background query is waiting for its
+        // response, the library stops waiting so that the new request goes
+        // out right away.
+        //
+        // Responses are reported to `Hooks::onQueryResponse` like any other.
+        // For CURRENTFILE, the query asks about the selected device, which
+        // only the local copy knows, so it needs AIDTOPIA_SERIALAUDIO_MIRROR.
+        // `folder` is used only with FOLDERFILECOUNT.  Returns false if
+        // there's no room for another background query.
+#if AIDTOPIA_SERIALAUDIO_BACKGROUND_TASKS
+        bool addBackgroundQuery(Parameter param, uint16_t period,
+                                uint16_t folder = 0);
+        void clearBackgroundQueries();
+#endif
+#if AIDTOPIA_SERIALAUDIO_BACKGROUND_TASKS || AIDTOPIA_SERIALAUDIO_VARIANT_PROBE
+        void setBackgroundGuard(uint16_t guard);
+#endif
+
+        Ticket stop();
+        Ticket pause();
+        Ticket unpause();
 
         // You can interrupt a track with an "advertisement" track from a folder
         // named "ADVERT" or "ADVERTn" for n in [1..9].  When the advertisement
@@ -239,9 +594,9 @@ class SerialAudio {
         // if it's paused).  Using stop during an advertisement stops all
         // playback.  Using stopAdvert stops only the advertisement, allowing
         // the interrupted track to resume.
-        void insertAdvert(uint16_t track);
-        void insertAdvert(uint8_t folder, uint8_t track);
-        void stopAdvert();
+        Ticket insertAdvert(uint16_t track);
+        Ticket insertAdvert(uint8_t folder, uint8_t track);
+        Ticket stopAdvert();
 
 #if 0  // TBD
     void sleep();
@@ -250,6 +605,79 @@ class SerialAudio {
     void enableDACs();
 #endif
 
+        // By default, each command requests feedback, and the next command
+        // waits until the module acknowledges it (or a timeout).  That limits
+        // the library to one command per round trip.
+        //
+        // Disabling feedback for a class of commands sends those commands
+        // without requesting an ACK.  They are paced only by a minimum gap
+        // between frames, so a burst of them goes out at nearly the speed of
+        // the serial line.  If the module rejects one of them, the error still
+        // arrives (asynchronously) and is reported to `Hooks::onError`.
+        void disableFeedback(CommandClass commands);
+        void enableFeedback(CommandClass commands);
+
+        // The minimum time, in milliseconds, between a command sent without
+        // feedback and the next frame.  The default is 20 ms.
+        void setMinimumGap(uint8_t gap);
+
+        // Commands waiting in the queue are rewritten as new ones arrive, so
+        // that the module gets fewer frames to the same effect:
+        //
+        //  * setVolume replaces the volume commands queued just before it.
+        //  * increaseVolume and decreaseVolume fold into a queued setVolume.
+        //  * stop discards the tracks queued just before it.  The volume of
+        //    a PLAYWITHVOLUME is kept, but its ticket is DROPPED.  Sequence
+        //    modes, adverts, and pauses are kept, along with anything
+        //    queued ahead of them.
+        //  * setVolume followed by playFile becomes a single PLAYWITHVOLUME.
+        //
+        // Commands already sent are never affected.  This is on by default.
+        // Turn it off if you need every command to reach the module as
+        // written (e.g., a module that doesn't understand PLAYWITHVOLUME).
+        void optimizeQueue(bool enable);
+
+        // What to do with a new command or query when its queue is full.
+        enum class OverflowPolicy : uint8_t {
+            REJECT,             // discard the new one (the default)
+            DROP_OLDEST,        // discard the one that's waited longest
+            REPLACE_SAME_KIND   // discard a waiting one of the same type,
+                                // else the new one
+        };
+        void setOverflowPolicy(OverflowPolicy policy);
+        OverflowPolicy overflowPolicy() const { return m_overflowPolicy; }
+
+        // The number of commands and queries discarded because of overflow.
+        uint16_t droppedCommands() const { return m_dropped; }
+
+        // When a command or query goes unanswered, or the module says it
+        // arrived garbled (SERIALERROR or BADCHECKSUM), the library sends it
+        // again, up to `attempts` more times.  It waits `backoff` ms before
+        // the first retry and twice as long before each one after that.  The
+        // hooks hear about the error only when the attempts run out.  The
+        // default is two attempts with a 20 ms backoff.  Zero attempts turns
+        // retries off.
+        //
+        // A garbled command is always safe to resend, since the module didn't
+        // act on it.  But when a command times out, the module may have acted
+        // on it and just lost the ACK.  Resending a command that does
+        // something different each time (VOLUMEUP, VOLUMEDOWN, PLAYNEXT,
+        // PLAYPREVIOUS, and inserting an advert) could then do it twice, so
+        // those are retried after a timeout only if `nonIdempotent` is true.
+#if AIDTOPIA_SERIALAUDIO_RETRY
+        void setRetryPolicy(uint8_t attempts, uint8_t backoff = 20,
+                            bool nonIdempotent = false);
+#endif
+
+#if AIDTOPIA_SERIALAUDIO_STATS
+        // Counters and latency histograms for diagnosing the protocol (see
+        // utilities/stats.h).  Build with AIDTOPIA_SERIALAUDIO_STATS set to 1
+        // to get these.  The returned reference stays valid, but its checksum
+        // and resync counts are brought up to date only by calling `stats`.
+        ProtocolStats const &stats() const;
+        void clearStats();
+#endif
+
     private:
         // The state keeps track of the last message sent and a checklist of
         // events to expect.
@@ -297,25 +725,307 @@ class SerialAudio {
                 uint8_t     m_flags;
         };
 
+        // A queued command or query.  The feedback to expect is determined
+        // from the message ID when it's dispatched, and the parameter is kept
+        // as bytes so that there's no padding.
         struct Command {
-            State state;
-            uint16_t param;
+            Message::ID msgid;
+            uint8_t     paramHi;
+            uint8_t     paramLo;
+
+            uint16_t param() const {
+                return (static_cast<uint16_t>(paramHi) << 8) | paramLo;
+            }
+            void setParam(uint16_t param) {
+                paramHi = static_cast<uint8_t>(param >> 8);
+                paramLo = static_cast<uint8_t>(param & 0x00FF);
+            }
+        };
+
+        // A command sent without feedback that the module hasn't yet shown
+        // it accepted.
+        struct Unconfirmed {
+            Message::ID msgid;
+            Ticket      ticket;
+        };
+
+        // A queue of requests.  The tickets are kept in a parallel array
+        // rather than in the Commands, so a build without tickets doesn't pay
+        // for them.
+        template <uint8_t DEPTH>
+        class RequestQueue : public Queue<Command, DEPTH> {
+            using Base = Queue<Command, DEPTH>;
+            public:
+#if AIDTOPIA_SERIALAUDIO_TICKETS
+                Ticket ticket(uint8_t index) const {
+                    return m_tickets[this->slot(index)];
+                }
+
+                bool pushFront(Command const &cmd, Ticket ticket) {
+                    if (!Base::pushFront(cmd)) return false;
+                    m_tickets[this->slot(0)] = ticket;
+                    return true;
+                }
+
+                bool pushBack(Command const &cmd, Ticket ticket) {
+                    if (!Base::pushBack(cmd)) return false;
+                    m_tickets[this->slot(this->size() - 1)] = ticket;
+                    return true;
+                }
+
+                void setTicket(uint8_t index, Ticket ticket) {
+                    m_tickets[this->slot(index)] = ticket;
+                }
+
+                void removeAt(uint8_t index) {
+                    for (uint8_t i = index; i + 1 < this->size(); ++i) {
+                        m_tickets[this->slot(i)] = m_tickets[this->slot(i+1)];
+                    }
+                    Base::removeAt(index);
+                }
+
+            private:
+                Ticket m_tickets[DEPTH];
+#else
+                Ticket ticket(uint8_t) const {
+                    return TicketTable<0>::STAND_IN;
+                }
+                bool pushFront(Command const &cmd, Ticket) {
+                    return Base::pushFront(cmd);
+                }
+                bool pushBack(Command const &cmd, Ticket) {
+                    return Base::pushBack(cmd);
+                }
+                void setTicket(uint8_t, Ticket) {}
+#endif
         };
+        using CommandQueue =
+            RequestQueue<AIDTOPIA_SERIALAUDIO_COMMAND_QUEUE_DEPTH>;
+        using QueryQueue = RequestQueue<AIDTOPIA_SERIALAUDIO_QUERY_QUEUE_DEPTH>;
+
+#if AIDTOPIA_SERIALAUDIO_EVENT_QUEUE_DEPTH
+        // Records events in compact form for later delivery.  It's derived
+        // from Hooks so that the event handling code doesn't need to know
+        // whether events are deferred, and so that duplicate notifications
+        // are filtered before they take up space.
+        class EventRing : public Hooks {
+            public:
+                uint8_t deliver(Hooks &hooks, uint8_t limit);
+                uint16_t dropped() const { return m_dropped; }
+                uint8_t size() const { return m_ring.size(); }
 
-        bool enqueue(Message::ID msgid, State::Flag flags, uint16_t data = 0);
+            private:
+                enum class Type : uint8_t {
+                    ERROR, QUERY_RESPONSE, DEVICE_CHANGE, FINISHED_FILE,
+                    INIT_COMPLETE, TRACK_STARTED, TRACK_ENDED, ADVERT_FINISHED
+                };
+                struct Event {
+                    Type     type;
+                    uint8_t  detail;  // message ID, parameter, or device(s)
+                    uint16_t value;
+                };
+
+                void record(Type type, uint8_t detail, uint16_t value = 0);
+
+                void onError(Error code, Message::ID msgid) override;
+                void onQueryResponse(Parameter param, uint16_t value) override;
+                void onDeviceChange(Device src, DeviceChange change) override;
+                void onFinishedFile(Device device, uint16_t index) override;
+                void onInitComplete(Devices devices) override;
+                void onTrackStarted() override;
+                void onTrackEnded() override;
+                void onAdvertFinished() override;
+
+                Queue<Event, AIDTOPIA_SERIALAUDIO_EVENT_QUEUE_DEPTH> m_ring;
+                uint16_t m_dropped = 0;
+        };
+#endif
+
+        static State::Flag expectations(Message::ID msgid);
+        Ticket enqueue(Message::ID msgid, uint16_t data = 0);
+        template <typename Lane>
+        bool push(Lane &lane, Command const &cmd, Ticket ticket);
+        bool coalesce(Message::ID msgid, uint16_t data);
         void onEvent(Message const &msg, Hooks *hooks);
         void handleEvent(Message const &msg, Hooks *hooks);
         bool continueDiscovery();
+        void finishCheck(Hooks *hooks);
+        bool recheckDevice();
+        static State::Flag checkFlag(Message::ID msgid);
         void dispatch();
-        void dispatch(Message::ID msgid, State::Flag flags, uint16_t data = 0);
-        void dispatch(Command const &cmd);
+        void dispatch(Message::ID msgid, State::Flag flags, uint16_t data = 0,
+                      Ticket ticket = NO_TICKET);
+        void dispatch(Command const &cmd, Ticket ticket);
+        void dropRequests();
         void onPowerUp();
+        void confirmUnconfirmed();
+        void rejectUnconfirmed(Message const &error, Hooks *hooks);
+
+        // Timeouts adapt to the latencies observed for each message ID.  The
+        // first phase of a command (the ACK or the response) is keyed by the
+        // message ID itself.  The second ACK is keyed with the high bit set.
+        enum : uint8_t { SECOND_PHASE = 0x80 };
+        uint8_t pendingKey() const;
+        void recordLatency(uint8_t key);
+        uint16_t elapsed() const;
+
+        // Answers from the FolderIndex, and refusals of requests the module
+        // can't handle, wait in m_answer until `update` has hooks to report
+        // them to.  A refusal is an ERROR whose parameter is the message ID.
+#if AIDTOPIA_SERIALAUDIO_FOLDER_INDEX
+        bool localAnswer(Command const &cmd, uint16_t *value) const;
+        void learn(Message const &msg);
+#endif
+        void completeLocally(Hooks *hooks);
+        bool supports(Message::ID msgid) const;
+        void refuse(Message::ID msgid);
+
+        // Identifying the variant takes up to two queries:  the firmware
+        // version, and, if that goes unanswered, the current flash file.
+#if AIDTOPIA_SERIALAUDIO_VARIANT_PROBE
+        enum class Probe : uint8_t { FIRMWARE, FLASHFILE, DONE };
+        void probeVariant(TimeRep now);
+        void identify(Message const &msg);
+#endif
+
+#if AIDTOPIA_SERIALAUDIO_BACKGROUND_TASKS
+        void runBackground(TimeRep now);
+#endif
+
+#if AIDTOPIA_SERIALAUDIO_PLAYLIST || AIDTOPIA_SERIALAUDIO_CUE
+        // The module often sends FINISHED twice.  A second one for the same
+        // file within this many milliseconds is a duplicate.
+        enum : uint16_t { DUPLICATE_FINISHED_WINDOW = 200 };
+        void onFinished(uint16_t index);
+        void checkPlaylistStopped(Message const &status);
+#endif
+#if AIDTOPIA_SERIALAUDIO_PLAYLIST
+        void advancePlaylist();
+        void playCurrentItem();
+        void skipFailedItem();
+        bool takeOverFromModule(Message::ID rejected);
+#endif
+
+#if AIDTOPIA_SERIALAUDIO_CUE
+        // A cue runs at most this many steps per update, so that a script
+        // that loops without waiting can't hang the sketch.
+        enum : uint8_t { CUE_STEPS_PER_UPDATE = 8 };
+        void stepCue(TimeRep now);
+        bool runCueStep(TimeRep now);
+        bool cueWaitingForTrack() const;
+        void cueTrackEnded();
+#endif
+#if AIDTOPIA_SERIALAUDIO_RETRY
+        bool retry(Message const &error);
+#endif
+#if AIDTOPIA_SERIALAUDIO_BUSY
+        void checkBusy(Hooks *hooks);
+#endif
+
+        // A command's timeout starts once its frame has left the serial port,
+        // so a slow port doesn't eat into the module's time to respond.  But a
+        // port that never makes room mustn't leave the request waiting
+        // forever, so until then, the timeout allows TX_STAGING_LIMIT more
+        // milliseconds.  (SoftwareSerial trickles a frame out a byte or two
+        // per update, so this allows for a slow loop.)
+        enum : uint16_t { TX_STAGING_LIMIT = 1000 };
+        void startTimeout(unsigned duration);
+        void checkTransmission(TimeRep now);
+        // During `update`, the time the pass started, so that the clock is read
+        // once per pass.  Otherwise (when the sketch makes a request), the
+        // clock.
+        TimeRep currentTime() const { return m_updating ? m_now : Clock::now(); }
+
+        // Pending requests wait in one of two lanes.  Commands, including
+        // settings like volume, stay in the order they were issued, and they
+        // go ahead of any queries.  After QUERY_STARVATION_LIMIT commands in a
+        // row, a waiting query gets a turn.
+        enum : uint8_t { QUERY_STARVATION_LIMIT = 4 };
 
         SerialAudioCore         m_core;
-        Queue<Command, 4>       m_queue;
+        CommandQueue            m_commands;
+        QueryQueue              m_queries;
+        uint8_t                 m_commandStreak = 0;
         State                   m_state;
-        Timeout<MillisClock>    m_timeout;
+        Timeout<Clock>          m_timeout;
+        TimeRep                 m_sentAt = 0;
+        uint16_t                m_txTimeout = 0;    // once the frame is out
+        bool                    m_transmitting = false;
+        TimeRep                 m_now = 0;          // of the current update pass
+        bool                    m_updating = false;
+        LatencyTable            m_latency;
         Devices                 m_available;
+        Devices                 m_expected = Devices(0x07);  // USB, SD, flash
+        Devices                 m_named;    // by INITCOMPLETE, if it came
+        Devices                 m_toCheck;  // inserted since initialization
+        ModuleMirror            m_mirror;
+#if AIDTOPIA_SERIALAUDIO_FOLDER_INDEX
+        FolderIndex            *m_index = nullptr;
+#endif
+        Message                 m_answer;
+        uint16_t                m_sentParam = 0;
+        Ticket                  m_sentTicket = NO_TICKET;
+        TicketTable<AIDTOPIA_SERIALAUDIO_TICKETS> m_tickets;
+#if AIDTOPIA_SERIALAUDIO_BACKGROUND_TASKS
+        BackgroundTasks<TimeRep, AIDTOPIA_SERIALAUDIO_BACKGROUND_TASKS>
+                                m_background;
+#endif
+#if AIDTOPIA_SERIALAUDIO_BACKGROUND_TASKS || AIDTOPIA_SERIALAUDIO_VARIANT_PROBE
+        TimeRep                 m_lastRequest = 0;
+        uint16_t                m_backgroundGuard = 100;
+        bool                    m_inBackground = false;
+        // A background query the library stopped waiting for, whose response
+        // may still arrive until m_abandonedTimeout expires.
+        Message::ID             m_abandoned = Message::ID::NONE;
+        Ticket                  m_abandonedTicket = NO_TICKET;
+        Timeout<Clock>          m_abandonedTimeout;
+#endif
+#if AIDTOPIA_SERIALAUDIO_PLAYLIST
+        Playlist               *m_playlist = nullptr;
+        uint16_t                m_playlistFailures = 0;
+        bool                    m_playlistOnModule = false;
+        bool                    m_moduleRejectsPlaylists = false;
+#endif
+#if AIDTOPIA_SERIALAUDIO_CUE
+        Cue                    *m_cue = nullptr;
+        bool                    m_cueing = false;   // sending a cue's command
+#endif
+#if AIDTOPIA_SERIALAUDIO_PLAYLIST || AIDTOPIA_SERIALAUDIO_CUE
+        uint8_t                 m_stoppedReports = 0;
+        uint16_t                m_finishedIndex = 0;
+        TimeRep                 m_finishedAt = 0;
+#endif
+#if AIDTOPIA_SERIALAUDIO_BUSY
+        BusySource             *m_busySource = nullptr;
+        bool                    m_busy = false;
+        bool                    m_resuming = false;  // after an advert
+#endif
+        bool                    m_advertPlaying = false;
+        uint8_t                 m_noFeedback = 0;   // CommandClass bits
+        uint8_t                 m_minimumGap = 20;
+        uint8_t                 m_frameBudget = 4;
+        Queue<Unconfirmed, 4>   m_unconfirmed;
+        bool                    m_optimize = true;
+#if AIDTOPIA_SERIALAUDIO_EVENT_QUEUE_DEPTH
+        bool                    m_deferEvents = false;
+        EventRing               m_events;
+#endif
+        OverflowPolicy          m_overflowPolicy = OverflowPolicy::REJECT;
+        uint16_t                m_dropped = 0;
+        StatsRecorder           m_stats;
+#if AIDTOPIA_SERIALAUDIO_RETRY
+        uint8_t                 m_retryAttempts = 2;
+        uint8_t                 m_retryBackoff = 20;
+        bool                    m_retryNonIdempotent = false;
+        uint8_t                 m_attempts = 0;  // retries of the current one
+        Command                 m_retrying = Command{Message::ID::NONE, 0, 0};
+        Ticket                  m_retryingTicket = NO_TICKET;
+#endif
+        Variant                 m_variant = Variant::UNKNOWN;
+#if AIDTOPIA_SERIALAUDIO_VARIANT_PROBE
+        Probe                   m_probe = Probe::FIRMWARE;
+        bool                    m_probing = false;
+#endif
 };
 
 SerialAudio::Devices operator|(SerialAudio::Device d1, SerialAudio::Device d2);
@@ -0,0 +1,86 @@
+// AidtopiaSerialAudioGroup
+// Adrian McCarthy 2018-
+
+// Drives several serial audio modules, each on its own serial port, from a
+// single `update` call.
+
+#ifndef AIDTOPIASERIALAUDIOGROUP_H
+#define AIDTOPIASERIALAUDIOGROUP_H
+
+#include "AidtopiaSerialAudio.h"
+
+namespace aidtopia {
+
+// Each module in the group has its own queue, state, and timeouts, so a
+// module that's slow to respond (or that has stopped responding altogether)
+// only delays the commands sent to that module.
+//
+// The group services the modules round-robin.  Each call to `update` reads
+// the clock once and shares that time with every module it services.
+template <uint8_t N>
+class SerialAudioGroup {
+    public:
+        static_assert(0 < N, "a group needs at least one module");
+
+        SerialAudioGroup() : m_hooks{}, m_next(0) {}
+
+        static constexpr uint8_t size() { return N; }
+
+        // Call `begin` for each module, typically in `setup`.
+        template <typename SerialType>
+        void begin(uint8_t index, SerialType &stream) {
+            m_modules[index].begin(stream);
+        }
+
+        // Hooks are optional and may be set per module.  Pass nullptr to
+        // remove them.
+        void setHooks(uint8_t index, SerialAudio::Hooks *hooks) {
+            m_hooks[index] = hooks;
+        }
+        void setHooks(uint8_t index, SerialAudio::Hooks &hooks) {
+            setHooks(index, &hooks);
+        }
+
+        // Use the subscript operator to send commands and queries to an
+        // individual module, e.g., `group[2].playTrack(5);`.
+        SerialAudio &operator[](uint8_t index) { return m_modules[index]; }
+        SerialAudio const &operator[](uint8_t index) const {
+            return m_modules[index];
+        }
+
+        // Client should call `update` frequently, typically each pass through
+        // the `loop` function.
+        //
+        // `budget` limits the number of modules serviced in this call.  The
+        // default is one full pass over the group.  A smaller budget bounds
+        // the time spent in each call, and the next call picks up with the
+        // next module in line.  A budget larger than the group still services
+        // each module only once.
+        //
+        // Returns true if every module serviced is ready for another command.
+        bool update(uint8_t budget = N) {
+            if (budget > N) budget = N;
+            auto const now = SerialAudio::Clock::now();
+            bool ready = true;
+            while (budget-- > 0) {
+                if (!m_modules[m_next].update(m_hooks[m_next], now)) {
+                    ready = false;
+                }
+                if (++m_next == N) m_next = 0;
+            }
+            return ready;
+        }
+
+    private:
+        SerialAudio         m_modules[N];
+        SerialAudio::Hooks *m_hooks[N];
+        uint8_t             m_next;
+};
+
+}
+
+// Make the class available in the global namespace.
+template <uint8_t N>
+using AidtopiaSerialAudioGroup = aidtopia::SerialAudioGroup<N>;
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef AIDTOPIA_SERIALAUDIOBACKGROUND_H
+#define AIDTOPIA_SERIALAUDIOBACKGROUND_H
+
+#include "utilities/message.h"
+
+namespace aidtopia {
+
+// A short list of queries to repeat periodically, each with its own period.
+// It only decides what's due.  It's up to the caller to decide whether the
+// link is idle enough to send it.
+template <typename TimeRep, uint8_t CAPACITY>
+class BackgroundTasks {
+    public:
+        struct Task {
+            Message::ID msgid;
+            uint16_t    param;
+            uint16_t    period;  // ms
+            TimeRep     last;    // when it last ran
+        };
+
+        BackgroundTasks() { clear(); }
+
+        void clear() { m_count = 0; }
+
+        // The new task is due right away.  Returns false if the list is full.
+        bool add(Message::ID msgid, uint16_t param, uint16_t period,
+                 TimeRep now) {
+            if (m_count == CAPACITY) return false;
+            m_tasks[m_count++] = Task{msgid, param, period, static_cast<TimeRep>(now - period)};
+            return true;
+        }
+
+        // Returns the most overdue task, or nullptr if none is due.  The task
+        // is rescheduled as though it ran at `now`.
+        Task const *take(TimeRep now) {
+            Task *next = nullptr;
+            TimeRep lateness = 0;
+            for (uint8_t i = 0; i < m_count; ++i) {
+                auto &task = m_tasks[i];
+                // Unsigned subtraction keeps this right across rollover.
+                auto const waited = static_cast<TimeRep>(now - task.last);
+                if (waited < task.period) continue;
+                auto const late = static_cast<TimeRep>(waited - task.period);
+                if (next == nullptr || late > lateness) {
+                    next = &task;
+                    lateness = late;
+                }
+            }
+            if (next != nullptr) next->last = now;
+            return next;
+        }
+
+    private:
+        Task    m_tasks[CAPACITY];
+        uint8_t m_count;
+};
+
+}
+
+#endif
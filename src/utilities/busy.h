@@ -0,0 +1,81 @@
+#ifndef AIDTOPIA_SERIALAUDIOBUSY_H
+#define AIDTOPIA_SERIALAUDIOBUSY_H
+
+namespace aidtopia {
+
+// Most modules have a BUSY output that's active while they're playing.  It
+// changes the moment playback starts or stops, long before the serial
+// notification arrives.  A BusySource tells SerialAudio what the line says.
+// (See `SerialAudio::useBusySource`.)
+//
+// To read the line some other way (e.g., through a port expander, or from a
+// simulation on a desktop), derive from BusySource.
+class BusySource {
+    public:
+        virtual ~BusySource() {}
+
+        // Returns true if the module is playing.
+        virtual bool busy() = 0;
+
+        // Returns true if the line went idle at some point since the last
+        // call, even if it's busy again now.  SerialAudio calls this just
+        // before `busy`.  A source that can only poll the line can't see a
+        // blip between polls, so the default says no.
+        virtual bool idledSinceLastCheck() { return false; }
+};
+
+// Polls a digital pin.  The DFPlayer Mini's BUSY output is low while it's
+// playing, so that's the default.
+class BusyPin : public BusySource {
+    public:
+        explicit BusyPin(uint8_t pin, bool activeLow = true) :
+            m_pin(pin), m_activeLow(activeLow) {}
+
+        // Call from `setup`.
+        void begin() { pinMode(m_pin, INPUT); }
+
+        bool busy() override {
+            return (digitalRead(m_pin) == LOW) == m_activeLow;
+        }
+
+    private:
+        uint8_t m_pin;
+        bool    m_activeLow;
+};
+
+// Like BusyPin, but a pin-change interrupt catches the line going idle, so a
+// brief gap (like the one between an advert and the track it interrupted)
+// isn't missed when `loop` is slow.  PIN must support external interrupts.
+// The interrupt handler is shared by all instances for the same PIN.
+template <uint8_t PIN, bool ACTIVE_LOW = true>
+class BusyInterruptPin : public BusySource {
+    public:
+        // Call from `setup`.
+        void begin() {
+            pinMode(PIN, INPUT);
+            attachInterrupt(digitalPinToInterrupt(PIN), onChange, CHANGE);
+        }
+
+        bool busy() override { return level(); }
+
+        bool idledSinceLastCheck() override {
+            noInterrupts();
+            bool const idled = s_idled;
+            s_idled = false;
+            interrupts();
+            return idled;
+        }
+
+    private:
+        static bool level() { return (digitalRead(PIN) == LOW) == ACTIVE_LOW; }
+        static void onChange() { if (!level()) s_idled = true; }
+
+        static volatile bool s_idled;
+};
+
+template <uint8_t PIN, bool ACTIVE_LOW>
+volatile bool BusyInterruptPin<PIN, ACTIVE_LOW>::s_idled = false;
+
+}
+
+#endif
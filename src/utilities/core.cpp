@@ -21,25 +21,86 @@ bool SerialAudioCore::checkForIncomingMessage() {
 #ifdef DEBUG
             Serial.print(F("< ")); dump(m_in.getBytes(), m_in.getLength());
 #endif
-            if (m_in.isValid()) return true;
+            auto const valid = m_in.isValid();
+#if AIDTOPIA_SERIALAUDIO_TRACE
+            if (m_trace != nullptr) {
+                uint8_t flags = TraceRecord::RECEIVED;
+                if (!valid) flags |= TraceRecord::CORRUPT;
+                m_trace->record(flags, static_cast<Message::ID>(m_in.getID()),
+                                m_in.getData());
+            }
+#endif
+            if (valid) return true;
+            ++m_dropped;
         }
     }
     return false;
 }
 
 void SerialAudioCore::send(Message const &msg, Feedback feedback) {
-    auto const out =
-        MessageBuffer(static_cast<uint8_t>(msg.getID()), msg.getParam(),
-                      feedback == Feedback::FEEDBACK);
-    const auto buf = out.getBytes();
-    const auto len = out.getLength();
-    m_stream->write(buf, len);
+    write(MessageBuffer(static_cast<uint8_t>(msg.getID()), msg.getParam(),
+                        feedback == Feedback::FEEDBACK));
+}
+
+void SerialAudioCore::send(Message::ID msgid, uint8_t const *data,
+                           uint8_t size, Feedback feedback) {
+    write(MessageBuffer(static_cast<uint8_t>(msgid), data, size,
+                        feedback == Feedback::FEEDBACK));
+}
+
+void SerialAudioCore::write(MessageBuffer const &out) {
+    // SerialAudio doesn't send a frame until the module has answered the
+    // previous one, so one is cut off only when a reset cuts in or the port
+    // has stopped taking bytes.  Finishing it could block, so the rest of it
+    // is dropped.  The module discards the fragment, since its end marker and
+    // checksum can't line up, and if the fragment takes the new frame down
+    // with it, the new frame's timeout catches that.
+    m_out = out;
+    m_outNext = 0;
+    drain();
+#if AIDTOPIA_SERIALAUDIO_TRACE
+    if (m_trace != nullptr) {
+        uint8_t flags = TraceRecord::SENT;
+        if (out.getBytes()[4] != 0) flags |= TraceRecord::FEEDBACK;
+        m_trace->record(flags, static_cast<Message::ID>(out.getID()),
+                        out.getData());
+    }
+#endif
 #ifdef DEBUG
-    Serial.print(F("> ")); dump(buf, len);
+    Serial.print(F("> ")); dump(out.getBytes(), out.getLength());
 #endif
 }
 
+void SerialAudioCore::drain() {
+    while (m_outNext < m_out.getLength()) {
+        auto room = m_stream->availableForWrite();
+        if (room > m_txRoom) m_txRoom = room;
+        if (room <= 0) {
+            // A port that has never reported any room probably doesn't track
+            // it (SoftwareSerial, for one, writes each byte before returning).
+            // Trickle those out a byte at a time so that no single call waits
+            // for more than one.
+            if (m_txRoom > 0) return;
+            room = 1;
+        }
+        auto const remaining = m_out.getLength() - m_outNext;
+        auto const count = room < remaining ? room : remaining;
+        auto const written =
+            m_stream->write(m_out.getBytes() + m_outNext, count);
+        if (written == 0) return;
+        m_outNext += written;
+        if (m_txRoom == 0) return;
+    }
+}
+
+bool SerialAudioCore::sending() {
+    drain();
+    if (m_outNext < m_out.getLength()) return true;
+    return m_txRoom > 0 && m_stream->availableForWrite() < m_txRoom;
+}
+
 bool SerialAudioCore::update(Message *msg) {
+    drain();
     if (checkForIncomingMessage()) {
         if (msg != nullptr) {
             *msg = Message{static_cast<Message::ID>(m_in.getID()), m_in.getData()};
@@ -3,6 +3,7 @@
 
 #include "utilities/message.h"
 #include "utilities/messagebuffer.h"
+#include "utilities/trace.h"
 
 namespace aidtopia {
 
@@ -19,14 +20,53 @@ class SerialAudioCore {
         // true.  Otherwise returns false.
         bool update(Message *msg = nullptr);
 
+        // `send` stages the frame and hands the serial port only as many bytes
+        // as it can take without blocking.  `update` (or `sending`) passes
+        // along the rest as room opens up.  Any part of the previous frame
+        // that hasn't gone out yet is dropped.
         void send(Message const &msg, Feedback feedback);
 
+        // For commands that carry more than two bytes of data.
+        void send(Message::ID msgid, uint8_t const *data, uint8_t size,
+                  Feedback feedback);
+
+        // Returns true until the last byte of the staged frame has left.  For a
+        // port that reports its transmit buffer space, that's when the buffer
+        // has emptied.  Otherwise, it's when the last byte was written.
+        bool sending();
+
+#if AIDTOPIA_SERIALAUDIO_TRACE
+        // Records each frame sent or received in `trace`, if it's not null.
+        void useTrace(Trace *trace) { m_trace = trace; }
+        Trace *trace() const { return m_trace; }
+#endif
+
+        // The number of received bytes waiting to be parsed.
+        int backlog() const { return m_stream->available(); }
+
+        // The number of complete frames discarded because of a bad checksum.
+        uint16_t droppedFrames() const { return m_dropped; }
+
+#if AIDTOPIA_SERIALAUDIO_STATS
+        uint16_t resyncs() const { return m_in.resyncs(); }
+#endif
+
     private:
         // Returns true if a complete and valid message has been received.
         bool checkForIncomingMessage();
 
+        void write(MessageBuffer const &out);
+        void drain();
+
         Stream        *m_stream;
-        MessageBuffer  m_in;
+        ReplyBuffer    m_in;
+        MessageBuffer  m_out;
+        uint8_t        m_outNext = 0;   // the next byte of m_out to write
+        int            m_txRoom = 0;    // most transmit space ever reported
+        uint16_t       m_dropped = 0;
+#if AIDTOPIA_SERIALAUDIO_TRACE
+        Trace         *m_trace = nullptr;
+#endif
 };
 
 }
@@ -0,0 +1,111 @@
+#ifndef AIDTOPIA_SERIALAUDIOCUE_H
+#define AIDTOPIA_SERIALAUDIOCUE_H
+
+#include "utilities/tickets.h"
+
+namespace aidtopia {
+
+// A fixed sequence of audio steps for SerialAudio to run by itself (see
+// `SerialAudio::runCue`), like "set the volume, play 03/007, wait for it to
+// finish, insert an advert, then ramp the volume down."
+//
+// The steps are a script of bytes, which can live in flash (PROGMEM), so a
+// Cue takes only a dozen bytes of RAM no matter how long its script is.  Each
+// step is an opcode followed by its operands.  A 16-bit operand is two bytes,
+// high byte first.
+//
+//     static uint8_t const intro[] PROGMEM = {
+//         Cue::VOLUME, 20,
+//         Cue::PLAY_FOLDER, 3, 7,
+//         Cue::WAIT_FINISHED,
+//         Cue::ADVERT, 0, 1,
+//         Cue::WAIT, 1500 >> 8, 1500 & 0xFF,
+//         Cue::RAMP, 0, 100,
+//         Cue::END
+//     };
+//     Cue cue(intro);
+//
+// A script must end with END or RESTART.
+class Cue {
+    public:
+        enum Op : uint8_t {
+            END,            // the cue is over
+            VOLUME,         // volume (0-30)
+            SOURCE,         // device, as in SerialAudio::Device
+            EQ,             // profile, as in SerialAudio::EqProfile
+            PLAY_FILE,      // file system index (16 bits)
+            PLAY_TRACK,     // track in the "MP3" folder (16 bits)
+            PLAY_FOLDER,    // folder, track
+            ADVERT,         // track in the "ADVERT" folder (16 bits)
+            STOP,
+            PAUSE,
+            UNPAUSE,
+            WAIT,           // milliseconds (16 bits)
+            WAIT_FINISHED,  // until the last thing this cue played finishes
+            RAMP,           // target volume, milliseconds per step
+            RESTART         // back to the first step
+        };
+
+        // `script` is in flash (PROGMEM).  It isn't copied, so it must
+        // outlive the Cue.
+        explicit Cue(uint8_t const *script) : m_script(script) {}
+
+        // The rest is for SerialAudio.
+
+        enum class Wait : uint8_t { NONE, TIME, FINISHED, RAMP };
+        enum : uint8_t { UNKNOWN_VOLUME = 0xFF };
+
+        void start() {
+            m_next = 0;
+            m_wait = Wait::NONE;
+            m_volume = UNKNOWN_VOLUME;
+            m_played = NO_TICKET;
+        }
+
+        uint8_t fetch() { return pgm_read_byte(m_script + m_next++); }
+        uint16_t fetchWord() {
+            uint16_t const hi = fetch();
+            return (hi << 8) | fetch();
+        }
+
+        // Where the next step starts, so that a step that can't run yet can
+        // be tried again.
+        uint16_t position() const { return m_next; }
+        void rewind(uint16_t position) { m_next = position; }
+
+        Wait waiting() const { return m_wait; }
+        void waitFor(Wait wait) { m_wait = wait; }
+
+        // Times are the low 16 bits of the library's clock.
+        void startTimer(uint16_t now, uint16_t duration) {
+            m_startedAt = now;
+            m_duration = duration;
+        }
+        void restartTimer(uint16_t now) { m_startedAt = now; }
+        bool timerExpired(uint16_t now) const {
+            return static_cast<uint16_t>(now - m_startedAt) >= m_duration;
+        }
+
+        uint8_t volume() const { return m_volume; }
+        void setVolume(uint8_t volume) { m_volume = volume; }
+        uint8_t target() const { return m_target; }
+        void setTarget(uint8_t target) { m_target = target; }
+
+        // The ticket for the cue's most recent play command.
+        Ticket played() const { return m_played; }
+        void setPlayed(Ticket ticket) { m_played = ticket; }
+
+    private:
+        uint8_t const *m_script;
+        uint16_t       m_next = 0;
+        uint16_t       m_startedAt = 0;
+        uint16_t       m_duration = 0;
+        Wait           m_wait = Wait::NONE;
+        uint8_t        m_volume = UNKNOWN_VOLUME;
+        uint8_t        m_target = 0;
+        Ticket         m_played = NO_TICKET;
+};
+
+}
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef AIDTOPIA_SERIALAUDIOEEPROMSTORAGE_H
+#define AIDTOPIA_SERIALAUDIOEEPROMSTORAGE_H
+
+#include <EEPROM.h>
+#include "utilities/folderindex.h"
+
+namespace aidtopia {
+
+// Keeps a FolderIndex in EEPROM starting at ADDRESS.  The index takes about
+// 60 bytes with the default AIDTOPIA_SERIALAUDIO_INDEX_FOLDERS.
+//
+// Only bytes that change are written, so the index doesn't wear out the
+// EEPROM unless the media changes often.  (On boards that emulate EEPROM in
+// flash, you may need to call EEPROM.commit() yourself.)
+template <int ADDRESS = 0>
+class EepromIndexStorage : public IndexStorage {
+    public:
+        bool load(uint8_t *data, uint16_t size) override {
+            for (uint16_t i = 0; i < size; ++i) {
+                data[i] = EEPROM.read(ADDRESS + i);
+            }
+            return true;
+        }
+
+        void save(uint8_t const *data, uint16_t size) override {
+            for (uint16_t i = 0; i < size; ++i) {
+                EEPROM.update(ADDRESS + i, data[i]);
+            }
+        }
+};
+
+}
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef AIDTOPIA_SERIALAUDIOFOLDERINDEX_H
+#define AIDTOPIA_SERIALAUDIOFOLDERINDEX_H
+
+// The number of numbered folders per device whose file counts are remembered.
+#ifndef AIDTOPIA_SERIALAUDIO_INDEX_FOLDERS
+#define AIDTOPIA_SERIALAUDIO_INDEX_FOLDERS 15
+#endif
+
+namespace aidtopia {
+
+// Somewhere to keep a FolderIndex between boots, like EEPROM.  (See
+// utilities/eepromstorage.h.)
+class IndexStorage {
+    public:
+        virtual ~IndexStorage() {}
+
+        // Returns false if nothing could be read.  FolderIndex validates what
+        // it gets, so it's fine to return whatever happens to be there.
+        virtual bool load(uint8_t *data, uint16_t size) = 0;
+        virtual void save(uint8_t const *data, uint16_t size) = 0;
+};
+
+// Remembers the folder count and the per-folder file counts for each storage
+// device, so that the library can answer those queries without asking the
+// module, which can take a long time on a large card.
+//
+// Each device's entry is keyed by a fingerprint:  the device's total file
+// count.  The library checks the fingerprint (with a file count query) each
+// time the module initializes.  Until it does, or if it doesn't match, the
+// entry isn't used.  Counts too big for a byte aren't remembered.
+class FolderIndex {
+    public:
+        enum : uint8_t { FOLDERS = AIDTOPIA_SERIALAUDIO_INDEX_FOLDERS };
+
+        explicit FolderIndex(IndexStorage *storage = nullptr) :
+            m_storage(storage) { clear(); }
+
+        // Reads the index from storage (if any).  SerialAudio does this when
+        // the index is attached, rather than the constructor, so that a
+        // global FolderIndex doesn't depend on the order of static
+        // initialization.
+        void load() {
+            clear();
+            if (m_storage == nullptr) return;
+            if (!m_storage->load(bytes(), sizeof(m_image)) || !valid()) clear();
+        }
+
+        // `device` is the protocol's device bit (0x01, 0x02, or 0x04).
+
+        // Called with the device's total file count once per initialization.
+        void setFingerprint(uint8_t device, uint16_t fileCount) {
+            auto *entry = find(device);
+            if (entry == nullptr) return;
+            m_verified |= device;
+            if (entry->fingerprint == fileCount) return;
+            forget(*entry);
+            entry->fingerprint = fileCount;
+            save();
+        }
+
+        bool folderCount(uint8_t device, uint16_t *count) const {
+            auto const *entry = verified(device);
+            if (entry == nullptr || entry->folders == UNKNOWN) return false;
+            *count = entry->folders;
+            return true;
+        }
+
+        bool fileCount(uint8_t device, uint16_t folder, uint16_t *count) const {
+            auto const *entry = verified(device);
+            if (entry == nullptr || folder == 0 || folder > FOLDERS) return false;
+            auto const files = entry->files[folder - 1];
+            if (files == UNKNOWN) return false;
+            *count = files;
+            return true;
+        }
+
+        void setFolderCount(uint8_t device, uint16_t count) {
+            auto *entry = verified(device);
+            if (entry == nullptr) return;
+            update(entry->folders, count);
+        }
+
+        void setFileCount(uint8_t device, uint16_t folder, uint16_t count) {
+            auto *entry = verified(device);
+            if (entry == nullptr || folder == 0 || folder > FOLDERS) return;
+            update(entry->files[folder - 1], count);
+        }
+
+        // The device's contents may have changed.
+        void invalidate(uint8_t device) {
+            auto *entry = find(device);
+            if (entry == nullptr) return;
+            m_verified &= ~device;
+            forget(*entry);
+            save();
+        }
+
+    private:
+        enum : uint8_t { VERSION = 1, UNKNOWN = 0xFF };
+        enum : uint16_t { NO_FINGERPRINT = 0xFFFF };
+
+        struct Entry {
+            uint16_t fingerprint;
+            uint8_t  folders;
+            uint8_t  files[FOLDERS];
+        };
+        struct Image {
+            uint8_t version;
+            uint8_t folders;   // so a change to FOLDERS invalidates the image
+            Entry   entries[3];
+            uint8_t checksum;
+        };
+
+        uint8_t *bytes() { return reinterpret_cast<uint8_t *>(&m_image); }
+
+        uint8_t sum() const {
+            auto const *p = reinterpret_cast<uint8_t const *>(&m_image);
+            uint8_t total = 0;
+            for (uint16_t i = 0; i < offsetof(Image, checksum); ++i) {
+                total += p[i];
+            }
+            return total;
+        }
+
+        bool valid() const {
+            return m_image.version == VERSION && m_image.folders == FOLDERS &&
+                   static_cast<uint8_t>(sum() + m_image.checksum) == 0;
+        }
+
+        void clear() {
+            m_image.version = VERSION;
+            m_image.folders = FOLDERS;
+            for (auto &entry : m_image.entries) {
+                forget(entry);
+                entry.fingerprint = NO_FINGERPRINT;
+            }
+            m_verified = 0;
+        }
+
+        static void forget(Entry &entry) {
+            entry.folders = UNKNOWN;
+            for (auto &files : entry.files) files = UNKNOWN;
+        }
+
+        void update(uint8_t &field, uint16_t count) {
+            uint8_t value = UNKNOWN;
+            if (count < UNKNOWN) value = static_cast<uint8_t>(count);
+            if (field == value) return;
+            field = value;
+            save();
+        }
+
+        void save() {
+            if (m_storage == nullptr) return;
+            m_image.checksum = static_cast<uint8_t>(-sum());
+            m_storage->save(bytes(), sizeof(m_image));
+        }
+
+        Entry *find(uint8_t device) {
+            switch (device) {
+                case 0x01: return &m_image.entries[0];
+                case 0x02: return &m_image.entries[1];
+                case 0x04: return &m_image.entries[2];
+                default:   return nullptr;
+            }
+        }
+
+        Entry const *verified(uint8_t device) const {
+            if ((m_verified & device) == 0) return nullptr;
+            return const_cast<FolderIndex *>(this)->find(device);
+        }
+
+        Entry *verified(uint8_t device) {
+            if ((m_verified & device) == 0) return nullptr;
+            return find(device);
+        }
+
+        IndexStorage *m_storage;
+        Image         m_image;
+        uint8_t       m_verified;  // device bits fingerprinted this session
+};
+
+}
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef AIDTOPIA_SERIALAUDIOLATENCY_H
+#define AIDTOPIA_SERIALAUDIOLATENCY_H
+
+// Set to 0 to use fixed timeouts rather than learning them from the latencies
+// the module shows.
+#ifndef AIDTOPIA_SERIALAUDIO_LATENCY
+#define AIDTOPIA_SERIALAUDIO_LATENCY 1
+#endif
+
+namespace aidtopia {
+
+#if AIDTOPIA_SERIALAUDIO_LATENCY
+
+// Learns how long the module takes to answer each kind of message and
+// suggests timeouts accordingly.
+//
+// Each key (typically a Message::ID) gets a smoothed round-trip time and a
+// smoothed deviation, updated the same way TCP estimates its retransmission
+// timeout (Jacobson/Karels).  The suggested timeout is the smoothed time plus
+// four deviations, clamped to [MIN_TIMEOUT, MAX_TIMEOUT].  When a wait times
+// out, the estimate backs off so that the next wait is twice as long.
+//
+// Only a handful of keys are tracked at once.  When the table is full, a new
+// key evicts an old one, which then reverts to its fallback timeout.
+class LatencyTable {
+    public:
+        enum : uint16_t {
+            MIN_TIMEOUT =   20,  // ms
+            MAX_TIMEOUT = 3000,  // ms
+            MIN_MARGIN  =   10   // ms
+        };
+
+        LatencyTable() { clear(); }
+
+        void clear() {
+            for (auto &entry : m_entries) entry.key = NO_KEY;
+            m_victim = 0;
+        }
+
+        // Returns the suggested timeout in milliseconds, or `fallback` if
+        // nothing has been learned about `key`.
+        uint16_t timeout(uint8_t key, uint16_t fallback) const {
+            auto const *entry = find(key);
+            if (entry == nullptr) return fallback;
+            uint16_t margin = entry->rttvar;
+            if (margin < MIN_MARGIN) margin = MIN_MARGIN;
+            return clamp((entry->srtt >> 3) + margin);
+        }
+
+        // Incorporates an observed round-trip time in milliseconds.
+        void record(uint8_t key, uint16_t elapsed) {
+            if (elapsed > MAX_TIMEOUT) elapsed = MAX_TIMEOUT;
+            auto *entry = find(key);
+            if (entry == nullptr) {
+                entry = claim(key);
+                entry->srtt = elapsed << 3;
+                entry->rttvar = elapsed << 1;
+                return;
+            }
+            // srtt is scaled by 8 and rttvar by 4, so the gains are 1/8 and
+            // 1/4, respectively.
+            int16_t error = static_cast<int16_t>(elapsed - (entry->srtt >> 3));
+            entry->srtt += error;
+            if (error < 0) error = -error;
+            entry->rttvar += error - static_cast<int16_t>(entry->rttvar >> 2);
+        }
+
+        // Notes that a wait of `waited` milliseconds wasn't long enough.
+        void backoff(uint8_t key, uint16_t waited) {
+            waited = clamp(waited);
+            auto *entry = find(key);
+            if (entry == nullptr) entry = claim(key);
+            // Results in a suggested timeout of twice the failed wait.
+            entry->srtt = waited << 3;
+            entry->rttvar = waited;
+        }
+
+    private:
+        enum : uint8_t { CAPACITY = 8, NO_KEY = 0x00 };
+
+        struct Entry {
+            uint8_t  key;
+            uint16_t srtt;    // scaled by 8
+            uint16_t rttvar;  // scaled by 4
+        };
+
+        static uint16_t clamp(uint16_t ms) {
+            if (ms < MIN_TIMEOUT) return MIN_TIMEOUT;
+            if (ms > MAX_TIMEOUT) return MAX_TIMEOUT;
+            return ms;
+        }
+
+        Entry const *find(uint8_t key) const {
+            for (auto const &entry : m_entries) {
+                if (entry.key == key) return &entry;
+            }
+            return nullptr;
+        }
+
+        Entry *find(uint8_t key) {
+            for (auto &entry : m_entries) {
+                if (entry.key == key) return &entry;
+            }
+            return nullptr;
+        }
+
+        Entry *claim(uint8_t key) {
+            auto *entry = find(NO_KEY);
+            if (entry == nullptr) {
+                entry = &m_entries[m_victim];
+                m_victim = (m_victim + 1) % CAPACITY;
+            }
+            entry->key = key;
+            return entry;
+        }
+
+        Entry   m_entries[CAPACITY];
+        uint8_t m_victim;
+};
+
+#else
+
+// Always suggests the fallback, so that the bookkeeping compiles away.
+class LatencyTable {
+    public:
+        void clear() {}
+        uint16_t timeout(uint8_t, uint16_t fallback) const { return fallback; }
+        void record(uint8_t, uint16_t) {}
+        void backoff(uint8_t, uint16_t) {}
+};
+
+#endif
+
+}
+
+#endif
@@ -7,65 +7,136 @@ static constexpr uint16_t combine(uint8_t hi, uint8_t lo) {
   return (static_cast<uint16_t>(hi) << 8) | lo;
 }
 
-MessageBuffer::MessageBuffer() :
-    m_buf{START, VERSION, LENGTH, 0, 0, 0, 0, 0, 0, END},
+template <uint8_t DATA>
+BasicMessageBuffer<DATA>::BasicMessageBuffer() :
+    m_buf{START, VERSION, LENGTH},
     m_length(0) {}
 
-MessageBuffer::MessageBuffer(uint8_t msgid, uint16_t param, bool feedback) :
-    m_buf{START, VERSION, LENGTH,
-          msgid,
-          static_cast<uint8_t>(feedback ? 0x01 : 0x00),
-          static_cast<uint8_t>((param >> 8) & 0xFF),
-          static_cast<uint8_t>((param     ) & 0xFF),
-          0, 0, END},
-    m_length(10)
+template <uint8_t DATA>
+BasicMessageBuffer<DATA>::BasicMessageBuffer(uint8_t msgid, uint16_t param,
+                                             bool feedback) :
+    m_buf{START, VERSION, LENGTH},
+    m_length(0)
 {
+    uint8_t const data[2] = {
+        static_cast<uint8_t>((param >> 8) & 0xFF),
+        static_cast<uint8_t>((param     ) & 0xFF)
+    };
+    encode(msgid, data, 2, feedback);
+}
+
+template <uint8_t DATA>
+BasicMessageBuffer<DATA>::BasicMessageBuffer(uint8_t msgid,
+                                             uint8_t const *data, uint8_t size,
+                                             bool feedback) :
+    m_buf{START, VERSION, LENGTH},
+    m_length(0)
+{
+    encode(msgid, data, size, feedback);
+}
+
+template <uint8_t DATA>
+void BasicMessageBuffer<DATA>::encode(uint8_t msgid, uint8_t const *data,
+                                      uint8_t size, bool feedback) {
+    if (size > MAX_DATA) size = MAX_DATA;
+    // Short payloads are padded with zeros.
+    uint8_t const count = size < 2 ? 2 : size;
+    m_buf[2] = static_cast<uint8_t>(LENGTH - 2 + count);
+    m_buf[3] = msgid;
+    m_buf[4] = feedback ? 0x01 : 0x00;
+    for (uint8_t i = 0; i < count; ++i) m_buf[5 + i] = i < size ? data[i] : 0;
+    auto const length = lengthField();
     auto const checksum = ~sum() + 1u;
-    m_buf[7] = (checksum >> 8) & 0xFF;
-    m_buf[8] = (checksum     ) & 0xFF;
+    m_buf[length + 1] = (checksum >> 8) & 0xFF;
+    m_buf[length + 2] = (checksum     ) & 0xFF;
+    m_buf[length + 3] = END;
+    m_length = length + 4;
 }
 
-uint8_t const *MessageBuffer::getBytes() const { return m_buf; }
-uint8_t MessageBuffer::getLength() const { return m_length; }
+template <uint8_t DATA>
+uint8_t const *BasicMessageBuffer<DATA>::getBytes() const { return m_buf; }
+template <uint8_t DATA>
+uint8_t BasicMessageBuffer<DATA>::getLength() const { return m_length; }
 
-bool MessageBuffer::isValid() const {
-    if (m_length == 8 && m_buf[7] == END) return true;
-    if (m_length != 10) return false;
-    auto const checksum = combine(m_buf[7], m_buf[8]);
-    return sum() + checksum == 0;
+template <uint8_t DATA>
+bool BasicMessageBuffer<DATA>::isValid() const {
+    auto const length = lengthField();
+    if (m_length == length + 2 && m_buf[length + 1] == END) return true;
+    if (m_length != length + 4) return false;
+    auto const checksum = combine(m_buf[length + 1], m_buf[length + 2]);
+    // The cast matters on platforms where `int` is wider than 16 bits.
+    return static_cast<uint16_t>(sum() + checksum) == 0;
 }
 
-uint8_t  MessageBuffer::getID()   const { return m_buf[3]; }
-uint16_t MessageBuffer::getData() const { return combine(m_buf[5], m_buf[6]); }
+template <uint8_t DATA>
+uint8_t BasicMessageBuffer<DATA>::getID() const { return m_buf[3]; }
+template <uint8_t DATA>
+uint16_t BasicMessageBuffer<DATA>::getData() const {
+    return combine(m_buf[5], m_buf[6]);
+}
+template <uint8_t DATA>
+uint8_t const *BasicMessageBuffer<DATA>::getPayload() const {
+    return &m_buf[5];
+}
+template <uint8_t DATA>
+uint8_t BasicMessageBuffer<DATA>::getPayloadLength() const {
+    return lengthField() - 4;
+}
 
-bool MessageBuffer::receive(uint8_t b) {
+template <uint8_t DATA>
+bool BasicMessageBuffer<DATA>::complete() const {
+    if (m_length < 3) return false;
+    auto const length = lengthField();
+    // Without a checksum, the frame ends right after the data.
+    return m_length == length + 4 ||
+           (m_length == length + 2 && m_buf[length + 1] == END);
+}
+
+template <uint8_t DATA>
+bool BasicMessageBuffer<DATA>::receive(uint8_t b) {
+    // After a complete frame, start fresh.
+    if (complete()) m_length = 0;
     switch (m_length) {
-        default:
-            // `m_length` is out of bounds, so start fresh.
-            m_length = 0;
-            [[fallthrough]];
-        case 0: case 1: case 2: case 9:
+        case 0: case 1:
             // These bytes must always match the template.
-            if (b == m_buf[m_length]) { ++m_length; return m_length == 10; }
-            // No match; try to resync.
-            if (b == START) { m_length = 1; return false; }
-            m_length = 0;
-            return false;
-        case 7:
-            // If there's no checksum, the message may end here.
-            if (b == END) { m_length = 8; return true; }
-            [[fallthrough]];
-        case 3: case 4: case 5: case 6: case 8:
-            // These are the payload bytes we care about.
-            m_buf[m_length++] = b;
-            return false;
+            if (b == m_buf[m_length]) { ++m_length; return false; }
+            break;
+        case 2:
+            // The length field tells us where the frame ends.
+            if (LENGTH <= b && b <= MAX_LENGTH) { m_buf[m_length++] = b; return false; }
+            break;
+        default: {
+            auto const length = lengthField();
+            if (m_length < length + 3) {
+                // The payload, or the checksum.  If there's no checksum, the
+                // message may end right after the payload.
+                m_buf[m_length++] = b;
+                return m_length == length + 2 && b == END;
+            }
+            if (b == END) { m_buf[m_length++] = b; return true; }
+            break;
+        }
     }
+    // No match; try to resync.
+#if AIDTOPIA_SERIALAUDIO_STATS
+    ++m_resyncs;
+#endif
+    m_length = (b == START) ? 1 : 0;
+    return false;
 }
 
-uint16_t MessageBuffer::sum() const {
+template <uint8_t DATA>
+uint16_t BasicMessageBuffer<DATA>::sum() const {
     uint16_t s = 0;
-    for (int i = 1; i <= LENGTH; ++i) s += m_buf[i];
+    auto const length = lengthField();
+    for (int i = 1; i <= length; ++i) s += m_buf[i];
     return s;
 }
 
+// The two sizes the library uses.
+template class BasicMessageBuffer<2>;
+#if AIDTOPIA_SERIALAUDIO_MAX_DATA != 2
+template class BasicMessageBuffer<AIDTOPIA_SERIALAUDIO_MAX_DATA>;
+#endif
+
 }
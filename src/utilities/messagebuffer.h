@@ -1,6 +1,14 @@
 #ifndef AIDTOPIA_SERIALAUDIOMESSAGEBUFFER_H
 #define AIDTOPIA_SERIALAUDIOMESSAGEBUFFER_H
 
+#include "utilities/stats.h"
+
+// The most data bytes a frame can carry.  Most messages have two, but a few
+// commands (like the module's combined play, 0x21) take more.
+#ifndef AIDTOPIA_SERIALAUDIO_MAX_DATA
+#define AIDTOPIA_SERIALAUDIO_MAX_DATA 16
+#endif
+
 namespace aidtopia {
 
 enum class Feedback : uint8_t {
@@ -8,36 +16,75 @@ enum class Feedback : uint8_t {
     FEEDBACK    = 0x01
 };
 
-// Manages a message buffer.
-class MessageBuffer {
+// Manages a message buffer with room for `DATA` data bytes.
+template <uint8_t DATA>
+class BasicMessageBuffer {
   public:
-    MessageBuffer();
-    MessageBuffer(uint8_t msgid, uint16_t data, bool feedback);
+    enum : uint8_t { MAX_DATA = DATA };
+
+    BasicMessageBuffer();
+    BasicMessageBuffer(uint8_t msgid, uint16_t data, bool feedback);
+    // For commands with more than two data bytes.  `size` is clamped to
+    // MAX_DATA, and frames always carry at least two data bytes.
+    BasicMessageBuffer(uint8_t msgid, uint8_t const *data, uint8_t size,
+                       bool feedback);
 
     const uint8_t *getBytes() const;
     uint8_t getLength() const;
     bool isValid() const;
     uint8_t getID() const;
+    // The first two data bytes, which is all most messages have.
     uint16_t getData() const;
+    uint8_t const *getPayload() const;
+    uint8_t getPayloadLength() const;
 
     // Returns true if the byte `b` completes a message.
     bool receive(uint8_t b);
+
+#if AIDTOPIA_SERIALAUDIO_STATS
+    // The number of received bytes that didn't fit the frame format.
+    uint16_t resyncs() const { return m_resyncs; }
+#endif
     
   private:
+    void encode(uint8_t msgid, uint8_t const *data, uint8_t size,
+                bool feedback);
+
+    // True if `m_length` bytes make a complete frame.
+    bool complete() const;
+
     // Sums the bytes used to compute the message's checksum.
     uint16_t sum() const;
 
+    // The frame's length field, which counts the bytes from VERSION through
+    // the last data byte.
+    uint8_t lengthField() const { return m_buf[2]; }
+
     enum : uint8_t {
         START   = 0x7E,
         VERSION = 0xFF,
-        LENGTH  = 0x06,
+        LENGTH  = 0x06,  // the usual length, with two data bytes
+        MAX_LENGTH = LENGTH - 2 + MAX_DATA,
         END     = 0xEF
     };
+    static_assert(2 <= MAX_DATA && MAX_DATA <= 0xFF - 10,
+                  "MAX_DATA must be between 2 and 245");
 
-    uint8_t m_buf[10];
+    // START, the counted bytes, two checksum bytes, and END
+    uint8_t m_buf[MAX_LENGTH + 4];
     uint8_t m_length;
+#if AIDTOPIA_SERIALAUDIO_STATS
+    uint16_t m_resyncs = 0;
+#endif
 };
 
+// For the frames we send, which may be long.
+using MessageBuffer = BasicMessageBuffer<AIDTOPIA_SERIALAUDIO_MAX_DATA>;
+
+// The module's frames always carry two data bytes, so there's no need to
+// make room for more when receiving them.
+using ReplyBuffer = BasicMessageBuffer<2>;
+
 }
 
 #endif
@@ -0,0 +1,228 @@
+#ifndef AIDTOPIA_SERIALAUDIOMIRROR_H
+#define AIDTOPIA_SERIALAUDIOMIRROR_H
+
+#include "utilities/message.h"
+
+// Set to 1 for the local copy of the module's settings (`SerialAudio::volume`
+// and friends).  Without it, a playlist or cue that follows the BUSY line
+// can't tell a track the sketch stopped from one that finished.
+#ifndef AIDTOPIA_SERIALAUDIO_MIRROR
+#define AIDTOPIA_SERIALAUDIO_MIRROR 0
+#endif
+
+namespace aidtopia {
+
+#if AIDTOPIA_SERIALAUDIO_MIRROR
+
+// Keeps a local copy of the module's settings and playback state so that the
+// client can read them without a round trip.
+//
+// The copy is updated from the commands as they're sent (on the assumption
+// that they'll succeed), from query responses, and from notifications.  Each
+// field has a stale bit.  A field is stale when we don't know its value (e.g.,
+// after a reset) or when something may have changed it behind our back (e.g.,
+// a command was rejected or a track finished).  A query response always makes
+// its field fresh again.
+//
+// Values are kept in the protocol's encoding.  It's up to the caller to
+// interpret them.
+class ModuleMirror {
+    public:
+        enum Field : uint8_t {
+            VOLUME   = 0x01,
+            EQ       = 0x02,
+            SEQUENCE = 0x04,
+            STATUS   = 0x08,  // the playback state
+            DEVICE   = 0x10,  // the selected device
+            ALL      = VOLUME | EQ | SEQUENCE | STATUS | DEVICE
+        };
+
+        uint8_t volume() const   { return m_volume; }
+        uint8_t eq() const       { return m_eq; }
+        uint8_t sequence() const { return m_sequence; }
+        uint8_t state() const    { return m_state; }
+        uint8_t device() const   { return m_device; }
+
+        bool isStale(Field field) const { return (m_stale & field) != 0; }
+        void invalidate(uint8_t fields) { m_stale |= fields; }
+
+        // Applies the expected effect of a command being sent.
+        void sent(Message const &msg) {
+            using ID = Message::ID;
+            auto const param = msg.getParam();
+            auto const lo = static_cast<uint8_t>(param & 0x00FF);
+            switch (msg.getID()) {
+                case ID::SETVOLUME:     setVolume(lo);  break;
+                // Relative changes are only useful if we know where we started.
+                case ID::VOLUMEUP:
+                    if (!isStale(VOLUME) && m_volume < 30) ++m_volume;
+                    break;
+                case ID::VOLUMEDOWN:
+                    if (!isStale(VOLUME) && m_volume > 0) --m_volume;
+                    break;
+                case ID::SETEQPROFILE:  set(EQ, m_eq, lo);  break;
+                case ID::PLAYWITHVOLUME:
+                    setVolume(static_cast<uint8_t>(param >> 8));
+                    play();
+                    break;
+                case ID::PLAYFILE:
+                case ID::PLAYNEXT:
+                case ID::PLAYPREVIOUS:
+                case ID::PLAYFROMFOLDER:
+                case ID::PLAYFROMMP3:
+                case ID::PLAYFROMBIGFOLDER:
+                case ID::PLAYLIST:
+                    // Some modules keep the previous sequence and some don't.
+                    invalidate(SEQUENCE);
+                    play();
+                    break;
+                case ID::LOOPALL:       play(LOOPALL);      break;
+                case ID::LOOPFOLDER:    play(LOOPFOLDER);   break;
+                case ID::LOOPFILE:      play(LOOPTRACK);    break;
+                case ID::RANDOMPLAY:    play(RANDOM);       break;
+                case ID::LOOPCURRENTTRACK:
+                    if (param == 0) set(SEQUENCE, m_sequence, LOOPTRACK);
+                    else invalidate(SEQUENCE);
+                    break;
+                case ID::STOP:
+                    setState(STOPPED);
+                    invalidate(SEQUENCE);
+                    break;
+                case ID::PAUSE:         setState(PAUSED);   break;
+                case ID::UNPAUSE:       setState(PLAYING);  break;
+                case ID::SELECTSOURCE:
+                    setState(STOPPED);
+                    set(DEVICE, m_device, lo);
+                    break;
+                case ID::RESET:         invalidate(ALL);    break;
+                default: break;
+            }
+        }
+
+        // Undoes the assumption that a command succeeded.
+        void rejected(Message::ID msgid) {
+            invalidate(affectedBy(msgid));
+        }
+
+        // Learns from an incoming message.
+        void received(Message const &msg) {
+            using ID = Message::ID;
+            auto const param = msg.getParam();
+            auto const lo = static_cast<uint8_t>(param & 0x00FF);
+            switch (msg.getID()) {
+                case ID::VOLUME:            set(VOLUME, m_volume, lo);      break;
+                case ID::EQPROFILE:         set(EQ, m_eq, lo);              break;
+                case ID::PLAYBACKSEQUENCE:  set(SEQUENCE, m_sequence, lo);  break;
+                case ID::STATUS:
+                    set(DEVICE, m_device, static_cast<uint8_t>(param >> 8));
+                    set(STATUS, m_state, lo);
+                    break;
+                case ID::FINISHEDUSBFILE:
+                case ID::FINISHEDSDFILE:
+                case ID::FINISHEDFLASHFILE:
+                    // In one of the looping sequences, the module goes on to
+                    // another track.  Otherwise (SINGLE, or a sequence that
+                    // isn't known), it has probably stopped, but
+                    // the notification may be a late or duplicate one for a
+                    // track that's already been followed by another.
+                    if (isStale(SEQUENCE) || m_sequence > RANDOM) {
+                        m_state = STOPPED;
+                    }
+                    invalidate(STATUS);
+                    break;
+                case ID::DEVICEINSERTED:
+                case ID::DEVICEREMOVED:
+                    // The module may switch to another device.
+                    invalidate(STATUS | DEVICE);
+                    break;
+                case ID::INITCOMPLETE:
+                    // The module has reset to its defaults, which vary by
+                    // model.
+                    invalidate(ALL);
+                    break;
+                default: break;
+            }
+        }
+
+    private:
+        // Protocol values for the playback state and sequence.
+        enum : uint8_t { STOPPED = 0, PLAYING = 1, PAUSED = 2 };
+        enum : uint8_t { LOOPALL = 0, LOOPFOLDER = 1, LOOPTRACK = 2, RANDOM = 3 };
+
+        void set(Field field, uint8_t &member, uint8_t value) {
+            member = value;
+            m_stale &= ~field;
+        }
+        void setVolume(uint8_t volume) { set(VOLUME, m_volume, volume); }
+        void setState(uint8_t state)   { set(STATUS, m_state, state); }
+        void play() { setState(PLAYING); }
+        void play(uint8_t sequence) {
+            set(SEQUENCE, m_sequence, sequence);
+            play();
+        }
+
+        static uint8_t affectedBy(Message::ID msgid) {
+            using ID = Message::ID;
+            switch (msgid) {
+                case ID::SETVOLUME:
+                case ID::VOLUMEUP:
+                case ID::VOLUMEDOWN:        return VOLUME;
+                case ID::SETEQPROFILE:      return EQ;
+                case ID::PLAYWITHVOLUME:    return VOLUME | STATUS;
+                case ID::LOOPALL:
+                case ID::LOOPFOLDER:
+                case ID::LOOPFILE:
+                case ID::RANDOMPLAY:
+                case ID::STOP:              return SEQUENCE | STATUS;
+                case ID::LOOPCURRENTTRACK:  return SEQUENCE;
+                case ID::PLAYFILE:
+                case ID::PLAYNEXT:
+                case ID::PLAYPREVIOUS:
+                case ID::PLAYFROMFOLDER:
+                case ID::PLAYFROMMP3:
+                case ID::PLAYFROMBIGFOLDER:
+                case ID::PLAYLIST:
+                case ID::PAUSE:
+                case ID::UNPAUSE:           return STATUS;
+                case ID::SELECTSOURCE:      return STATUS | DEVICE;
+                default:                    return 0;
+            }
+        }
+
+        uint8_t m_volume = 0;
+        uint8_t m_eq = 0;
+        uint8_t m_sequence = 0;
+        uint8_t m_state = 0;
+        uint8_t m_device = 0;
+        uint8_t m_stale = ALL;
+};
+
+#else
+
+// Knows nothing, so every field is always stale.
+class ModuleMirror {
+    public:
+        enum Field : uint8_t {
+            VOLUME   = 0x01,
+            EQ       = 0x02,
+            SEQUENCE = 0x04,
+            STATUS   = 0x08,
+            DEVICE   = 0x10,
+            ALL      = VOLUME | EQ | SEQUENCE | STATUS | DEVICE
+        };
+
+        uint8_t volume() const   { return 0; }
+        uint8_t state() const    { return 0; }
+        uint8_t device() const   { return 0; }
+        bool isStale(Field) const { return true; }
+        void invalidate(uint8_t) {}
+        void sent(Message const &) {}
+        void rejected(Message::ID) {}
+        void received(Message const &) {}
+};
+
+#endif
+
+}
+
+#endif
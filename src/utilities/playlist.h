@@ -0,0 +1,165 @@
+#ifndef AIDTOPIA_SERIALAUDIOPLAYLIST_H
+#define AIDTOPIA_SERIALAUDIOPLAYLIST_H
+
+#include "utilities/message.h"
+
+namespace aidtopia {
+
+// A sequence of sounds for SerialAudio to play one after another.  (See
+// `SerialAudio::play(Playlist &)`.)
+//
+// A Playlist is either a list of numbers in the sketch's memory or a range of
+// consecutive numbers, so it takes the same small amount of RAM no matter how
+// long it is.  Shuffling doesn't need a shuffled copy either.  Each pass
+// visits the items in the order of a pseudorandom permutation, generated one
+// step at a time (see `advance`).
+class Playlist {
+    public:
+        enum class Repeat : uint8_t {
+            OFF,    // play each item once
+            ALL,    // start over after the last item (reshuffled if shuffling)
+            ONE     // play the current item over and over
+        };
+
+        // Lists of file system indexes (like `playFile`) or of tracks in the
+        // "MP3" folder (like `playTrack(track)`).  The list isn't copied, so
+        // it must outlive the Playlist.
+        static Playlist ofFiles(uint16_t const *files, uint16_t count) {
+            return Playlist(Message::ID::PLAYFILE, files, 0, count, 0);
+        }
+        static Playlist ofTracks(uint16_t const *tracks, uint16_t count) {
+            return Playlist(Message::ID::PLAYFROMMP3, tracks, 0, count, 0);
+        }
+
+        // File system indexes `first` through `last`.
+        static Playlist fileRange(uint16_t first, uint16_t last) {
+            return Playlist(Message::ID::PLAYFILE, nullptr, first,
+                            last >= first ? last - first + 1 : 0, 0);
+        }
+
+        // Tracks `first` through `last` in a numbered folder.
+        static Playlist folder(uint8_t folder, uint8_t first, uint8_t last) {
+            return Playlist(Message::ID::PLAYFROMFOLDER, nullptr, first,
+                            last >= first ? last - first + 1 : 0, folder);
+        }
+
+        // A list of tracks in a numbered folder.  The module can't play a
+        // track above 255 from a numbered folder, so a list that has one
+        // makes an empty Playlist (`size` is 0), which `play` refuses.
+        static Playlist inFolder(uint8_t folder, uint16_t const *tracks,
+                                 uint16_t count) {
+            for (uint16_t i = 0; i < count; ++i) {
+                if (tracks[i] > 0xFF) { count = 0; break; }
+            }
+            return Playlist(Message::ID::PLAYFROMFOLDER, tracks, 0, count,
+                            folder);
+        }
+
+        void setRepeat(Repeat repeat) { m_repeat = repeat; }
+        void setShuffle(bool shuffle) { m_shuffle = shuffle; }
+        uint16_t size() const { return m_count; }
+
+        // The rest is for SerialAudio.
+
+        // Begins the first pass.  Returns false if the list is empty.
+        bool start(uint16_t seed) {
+            m_seed = seed;
+            m_played = 0;
+            if (m_count == 0) return false;
+            beginPass();
+            return advance();
+        }
+
+        // Moves to the next item.  Returns false when the playlist is over.
+        bool advance() {
+            if (m_repeat == Repeat::ONE && m_played > 0) return true;
+            if (m_played == m_count) {
+                if (m_repeat != Repeat::ALL) return false;
+                beginPass();
+            }
+            if (m_shuffle) {
+                // Step the generator until it lands in range.  It visits
+                // every value below m_mask + 1 once per cycle, so the values
+                // it accepts are a permutation of [0, m_count).
+                do {
+                    m_lcg = (m_multiplier * m_lcg + m_increment) & m_mask;
+                } while (m_lcg >= m_count);
+                m_position = m_lcg;
+            } else {
+                m_position = m_played;
+            }
+            ++m_played;
+            return true;
+        }
+
+        // The command that plays the current item.
+        Message current() const {
+            auto const n = m_list != nullptr ? m_list[m_position]
+                                             : m_first + m_position;
+            if (m_msgid == Message::ID::PLAYFROMFOLDER) {
+                return Message{m_msgid, static_cast<uint16_t>(
+                    (static_cast<uint16_t>(m_folder) << 8) | (n & 0xFF))};
+            }
+            return Message{m_msgid, static_cast<uint16_t>(n)};
+        }
+
+        // Fills `data` with the payload for the module's own combined play
+        // command (0x21):  a folder number and a track number for each item.
+        // Returns the number of bytes, or 0 if the module can't play this
+        // playlist by itself.  That's the case if the items aren't in
+        // numbered folders, if it's shuffled or repeats, or if it doesn't fit.
+        uint8_t modulePayload(uint8_t *data, uint8_t capacity) const {
+            if (m_msgid != Message::ID::PLAYFROMFOLDER) return 0;
+            if (m_shuffle || m_repeat != Repeat::OFF) return 0;
+            if (m_count == 0 || m_count > capacity / 2) return 0;
+            for (uint16_t i = 0; i < m_count; ++i) {
+                auto const n = m_list != nullptr ? m_list[i] : m_first + i;
+                *data++ = m_folder;
+                *data++ = static_cast<uint8_t>(n);
+            }
+            return static_cast<uint8_t>(2 * m_count);
+        }
+
+    private:
+        Playlist(Message::ID msgid, uint16_t const *list, uint16_t first,
+                 uint16_t count, uint8_t folder) :
+            m_list(list), m_first(first), m_count(count), m_msgid(msgid),
+            m_folder(folder) {}
+
+        void beginPass() {
+            m_played = 0;
+            if (!m_shuffle) return;
+            // A linear congruential generator modulo a power of two has a
+            // full period when the increment is odd and the multiplier is one
+            // more than a multiple of four (Hull-Dobell).  The seed picks both
+            // and the starting point, and each pass gets a new seed.
+            m_mask = 1;
+            while (m_mask < m_count) m_mask <<= 1;
+            m_mask -= 1;
+            m_seed = static_cast<uint16_t>(m_seed * 25173u + 13849u);
+            m_multiplier = static_cast<uint16_t>(((m_seed >> 4) << 2) | 1);
+            m_increment = static_cast<uint16_t>((m_seed >> 8) | 1);
+            m_lcg = m_seed & m_mask;
+        }
+
+        uint16_t const *m_list;
+        uint16_t        m_first;
+        uint16_t        m_count;
+        Message::ID     m_msgid;
+        uint8_t         m_folder;
+        Repeat          m_repeat = Repeat::OFF;
+        bool            m_shuffle = false;
+
+        // Progress through the current pass
+        uint16_t        m_position = 0;
+        uint16_t        m_played = 0;
+        uint16_t        m_seed = 0;
+        uint16_t        m_mask = 0;
+        uint16_t        m_multiplier = 1;
+        uint16_t        m_increment = 1;
+        uint16_t        m_lcg = 0;
+};
+
+}
+
+#endif
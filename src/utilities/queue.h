@@ -3,47 +3,81 @@
 
 namespace aidtopia {
 
-// A ring-buffer based queue with a maximum of 8 elements.
+// A ring-buffer based queue.  CAPACITY must be a power of two (up to 128) so
+// that wrapping an index is just a mask.
 template <typename T, uint8_t CAPACITY=8>
 class Queue {
     public:
         Queue() { clear(); }
 
         void clear() {
-            m_head = m_tail = 0;
-            m_full = 0;
-            m_reserved = 0;
+            m_head = 0;
+            m_count = 0;
         }
-        
-        bool empty() const { return m_head == m_tail && !m_full; }
-        bool full() const  { return m_full; }
+
+        bool empty() const { return m_count == 0; }
+        bool full() const  { return m_count == CAPACITY; }
+        uint8_t size() const { return m_count; }
+        static constexpr uint8_t capacity() { return CAPACITY; }
 
         // Assumes !empty().
         T const &peekFront() const { return m_buffer[m_head]; }
+        T &back() { return (*this)[m_count - 1]; }
+
+        // Elements are indexed from the front.  Assumes index < size().
+        T &operator[](uint8_t index) {
+            return m_buffer[(m_head + index) & MASK];
+        }
+        T const &operator[](uint8_t index) const {
+            return m_buffer[(m_head + index) & MASK];
+        }
+
+        // Removes the element at `index`, preserving the order of the rest.
+        void removeAt(uint8_t index) {
+            if (index >= m_count) return;
+            for (uint8_t i = index; i + 1 < m_count; ++i) {
+                (*this)[i] = (*this)[i + 1];
+            }
+            --m_count;
+        }
 
         void popFront() {
             if (empty()) return;
-            m_head = (m_head + 1) % CAPACITY;
-            m_full = 0;
+            m_head = (m_head + 1) & MASK;
+            --m_count;
+        }
+
+        // Returns true if successful or false if the queue is already full.
+        bool pushFront(T const &item) {
+            if (full()) return false;
+            m_head = (m_head + MASK) & MASK;
+            ++m_count;
+            m_buffer[m_head] = item;
+            return true;
         }
 
         // Returns true if successful or false if the queue is already full.
         bool pushBack(T const &item) {
-            if (m_full) return false;
-            m_buffer[m_tail] = item;
-            m_tail = (m_tail + 1) % CAPACITY;
-            m_full = m_tail == m_head;
+            if (full()) return false;
+            (*this)[m_count++] = item;
             return true;
         }
 
+    protected:
+        // Where the element at `index` lives in the buffer, so that a derived
+        // class can keep a parallel array.
+        uint8_t slot(uint8_t index) const { return (m_head + index) & MASK; }
+
     private:
-        static_assert(2 <= CAPACITY && CAPACITY <= 8);
+        static_assert(2 <= CAPACITY && CAPACITY <= 128,
+                      "Queue capacity must be between 2 and 128");
+        static_assert((CAPACITY & (CAPACITY - 1)) == 0,
+                      "Queue capacity must be a power of two");
+        enum : uint8_t { MASK = CAPACITY - 1 };
 
         T       m_buffer[CAPACITY];
-        uint8_t m_head : 3;  // log_2(CAPACITY)
-        uint8_t m_tail : 3;  // log_2(CAPACITY)
-        uint8_t m_full : 1;
-        uint8_t m_reserved : 1;
+        uint8_t m_head;
+        uint8_t m_count;
 };
 
 }
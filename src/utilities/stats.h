@@ -0,0 +1,139 @@
+#ifndef AIDTOPIA_SERIALAUDIOSTATS_H
+#define AIDTOPIA_SERIALAUDIOSTATS_H
+
+#include "utilities/message.h"
+
+// Set to 1 to have SerialAudio keep protocol statistics (see
+// `SerialAudio::stats`).  They cost about a kilobyte of RAM, which is more
+// than an Uno can usually spare, so they're off by default.  When they're
+// off, the bookkeeping compiles away.
+#ifndef AIDTOPIA_SERIALAUDIO_STATS
+#define AIDTOPIA_SERIALAUDIO_STATS 0
+#endif
+
+namespace aidtopia {
+
+// A snapshot of what the library has seen on the serial line.
+struct ProtocolStats {
+    // Latencies are binned by powers of two:  under 4 ms, under 8 ms, ...,
+    // under 256 ms, and 256 ms or more.
+    enum : uint8_t { BUCKETS = 8 };
+    static uint8_t bucket(uint16_t ms) {
+        uint8_t b = 0;
+        for (uint16_t limit = 4; b + 1 < BUCKETS && ms >= limit; limit <<= 1) {
+            ++b;
+        }
+        return b;
+    }
+
+    struct PerMessage {
+        uint16_t sent;
+        uint16_t latency[BUCKETS];  // time to the ACK or the response
+    };
+
+    // Only commands (0x01-0x25) and queries (0x3F-0x4F, 0x61) are tracked.
+    enum : uint8_t { COMMANDS = 0x25, QUERIES = 0x4F - 0x3F + 1 };
+    enum : uint8_t { SLOTS = COMMANDS + QUERIES + 1 };
+    static int8_t slot(Message::ID msgid) {
+        auto const id = static_cast<uint8_t>(msgid);
+        if (0x01 <= id && id <= 0x25) return id - 0x01;
+        if (0x3F <= id && id <= 0x4F) return COMMANDS + id - 0x3F;
+        if (id == 0x61) return SLOTS - 1;
+        return -1;
+    }
+
+    // Returns nullptr for messages that aren't tracked.
+    PerMessage const *forMessage(Message::ID msgid) const {
+        auto const i = slot(msgid);
+        return i < 0 ? nullptr : &messages[i];
+    }
+
+    PerMessage messages[SLOTS];
+    uint16_t   timeouts;
+    uint16_t   retries;
+    uint16_t   backgroundFailures;   // background queries that went unanswered
+    uint16_t   unexpectedAcks;
+    uint16_t   unexpectedResponses;  // including responses to other queries
+    uint16_t   checksumFailures;
+    uint16_t   resyncs;              // bytes that didn't fit the frame format
+    uint8_t    commandHighWater;     // the most waiting at once
+    uint8_t    queryHighWater;
+    uint8_t    eventHighWater;
+};
+
+#if AIDTOPIA_SERIALAUDIO_STATS
+
+// What SerialAudio uses to keep the statistics.
+class StatsRecorder {
+    public:
+        StatsRecorder() { clear(0, 0); }
+
+        // The serial core keeps its own running counts of checksum failures
+        // and resyncs, so the caller passes them in.
+        void clear(uint16_t checksumFailures, uint16_t resyncs) {
+            memset(&m_stats, 0, sizeof(m_stats));
+            m_checksumBase = checksumFailures;
+            m_resyncBase = resyncs;
+        }
+        // The stats are too big to copy around on a small board, so this
+        // brings the core's counts up to date and hands back a reference.
+        ProtocolStats const &snapshot(uint16_t checksumFailures,
+                                      uint16_t resyncs) const {
+            m_stats.checksumFailures = checksumFailures - m_checksumBase;
+            m_stats.resyncs = resyncs - m_resyncBase;
+            return m_stats;
+        }
+
+        void sent(Message::ID msgid) {
+            auto *entry = find(msgid);
+            if (entry != nullptr) ++entry->sent;
+        }
+        void latency(Message::ID msgid, uint16_t ms) {
+            auto *entry = find(msgid);
+            if (entry != nullptr) ++entry->latency[ProtocolStats::bucket(ms)];
+        }
+        void timeout()            { ++m_stats.timeouts; }
+        void retry()              { ++m_stats.retries; }
+        void backgroundFailure()  { ++m_stats.backgroundFailures; }
+        void unexpectedAck()      { ++m_stats.unexpectedAcks; }
+        void unexpectedResponse() { ++m_stats.unexpectedResponses; }
+        void commands(uint8_t depth) { raise(m_stats.commandHighWater, depth); }
+        void queries(uint8_t depth)  { raise(m_stats.queryHighWater, depth); }
+        void events(uint8_t depth)   { raise(m_stats.eventHighWater, depth); }
+
+    private:
+        ProtocolStats::PerMessage *find(Message::ID msgid) {
+            auto const i = ProtocolStats::slot(msgid);
+            return i < 0 ? nullptr : &m_stats.messages[i];
+        }
+        static void raise(uint8_t &mark, uint8_t depth) {
+            if (depth > mark) mark = depth;
+        }
+
+        mutable ProtocolStats m_stats;  // snapshot patches in the core's counts
+        uint16_t              m_checksumBase;
+        uint16_t              m_resyncBase;
+};
+
+#else
+
+// Does nothing, so that the calls compile away.
+class StatsRecorder {
+    public:
+        void sent(Message::ID) {}
+        void latency(Message::ID, uint16_t) {}
+        void timeout() {}
+        void retry() {}
+        void backgroundFailure() {}
+        void unexpectedAck() {}
+        void unexpectedResponse() {}
+        void commands(uint8_t) {}
+        void queries(uint8_t) {}
+        void events(uint8_t) {}
+};
+
+#endif
+
+}
+
+#endif
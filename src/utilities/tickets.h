@@ -0,0 +1,75 @@
+#ifndef AIDTOPIA_SERIALAUDIOTICKETS_H
+#define AIDTOPIA_SERIALAUDIOTICKETS_H
+
+namespace aidtopia {
+
+// Identifies one command or query the sketch asked for.  NO_TICKET means the
+// request was never made (for example, because the module can't do it).
+// Tickets are numbered from 1 and wrap around after 255.
+using Ticket = uint8_t;
+constexpr Ticket NO_TICKET = 0;
+
+enum class TicketStatus : uint8_t {
+    UNKNOWN,    // NO_TICKET, or too old to be remembered
+    PENDING,    // waiting in a queue
+    SENT,       // sent to the module, which hasn't answered (yet)
+    ACKED,      // acknowledged, or the query was answered
+    FAILED,     // the module (or the library) rejected it
+    TIMEDOUT,   // the module never answered
+    DROPPED     // discarded before it finished (queue full, reset, etc.)
+};
+
+// Remembers the status of the most recently issued tickets.  Ticket `t` lives
+// in slot `t % CAPACITY`, so once CAPACITY newer tickets have been issued,
+// an old one's status becomes UNKNOWN.  CAPACITY must be a power of two, or 0
+// to do without tickets altogether.
+template <uint8_t CAPACITY>
+class TicketTable {
+    public:
+        Ticket issue() {
+            if (++m_last == NO_TICKET) ++m_last;
+            m_entries[m_last & MASK] = Entry{m_last, TicketStatus::PENDING};
+            return m_last;
+        }
+
+        // Does nothing if the ticket has already been forgotten.
+        void set(Ticket ticket, TicketStatus status) {
+            if (ticket == NO_TICKET) return;
+            auto &entry = m_entries[ticket & MASK];
+            if (entry.ticket == ticket) entry.status = status;
+        }
+
+        TicketStatus status(Ticket ticket) const {
+            if (ticket == NO_TICKET) return TicketStatus::UNKNOWN;
+            auto const &entry = m_entries[ticket & MASK];
+            return entry.ticket == ticket ? entry.status
+                                          : TicketStatus::UNKNOWN;
+        }
+
+    private:
+        static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0,
+                      "CAPACITY must be a power of two");
+        enum : uint8_t { MASK = CAPACITY - 1 };
+
+        struct Entry {
+            Ticket       ticket;
+            TicketStatus status;
+        };
+        Entry  m_entries[CAPACITY] = {};
+        Ticket m_last = NO_TICKET;
+};
+
+// Without a table, every request gets the same ticket, which still tells a
+// request that was made from one that wasn't.
+template <>
+class TicketTable<0> {
+    public:
+        enum : Ticket { STAND_IN = 1 };
+        Ticket issue() { return STAND_IN; }
+        void set(Ticket, TicketStatus) {}
+        TicketStatus status(Ticket) const { return TicketStatus::UNKNOWN; }
+};
+
+}
+
+#endif
@@ -17,22 +17,29 @@ class Timeout {
 
     void cancel() { m_expires = 0; }
 
-    bool expired() const {
+    bool expired() const { return expired(Clock::now()); }
+
+    // This overload lets a caller that's polling several timeouts read the
+    // clock just once and share the result.
+    bool expired(TimeRep now) const {
       if (m_expires == 0) return false;
-      const auto now = Clock::now();
-      if (now < m_expires) return false;
-      // It looks like the timer had expired, but we have to
-      // check for rollover first.  If MSB of m_expires is 0
-      // and the MSB of now is 1, then we need to wait for the
-      // clock to roll over.  The conditions above mean we
-      // already know now >= m_expires, so this boils down to
-      // whether the MSBs are different, thus the exclusive-or.
-      return !((now ^ m_expires) & MSB_MASK);
+      // The difference wraps along with the clock, so it's
+      // "negative" (MSB set) until the expiration time and
+      // "positive" for half the clock's range after, even if
+      // the clock rolls over in between.  Comparing `now` with
+      // `m_expires` directly goes wrong when the first check
+      // after the expiration comes after the clock's MSB has
+      // flipped (at rollover or halfway to it).  Then the
+      // timeout wouldn't fire until the clock came all the way
+      // around again (49 days for millis).
+      return !(static_cast<TimeRep>(now - m_expires) & MSB_MASK);
     }
     
     // `delta` must be less than half of the range of a TimeRep.
-    void set(TimeRep delta) {
-      const auto now = Clock::now();
+    void set(TimeRep delta) { set(delta, Clock::now()); }
+
+    // Like `expired`, this overload lets the caller share a clock reading.
+    void set(TimeRep delta, TimeRep now) {
       m_expires = now + delta;
       if (m_expires == 0) {
         // Since we use `m_expires == 0` to mean "no timeout,"
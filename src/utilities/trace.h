@@ -0,0 +1,102 @@
+#ifndef AIDTOPIA_SERIALAUDIOTRACE_H
+#define AIDTOPIA_SERIALAUDIOTRACE_H
+
+#include "utilities/message.h"
+
+// Set to 1 for tracing (`SerialAudio::useTrace`).  Without it, the checks for
+// a trace on every frame compile away.
+#ifndef AIDTOPIA_SERIALAUDIO_TRACE
+#define AIDTOPIA_SERIALAUDIO_TRACE 0
+#endif
+
+namespace aidtopia {
+
+// One event in a trace:  a frame sent or received, or a request the sketch
+// made of SerialAudio.  Frames are kept as their message ID and first two
+// data bytes, which is all the protocol uses (except for the combined play
+// command).
+struct TraceRecord {
+    enum : uint8_t {
+        SENT      = 0x01,
+        RECEIVED  = 0x02,
+        REQUESTED = 0x03,
+        KIND      = 0x03,  // mask for the above
+        FEEDBACK  = 0x04,  // a sent frame asked for an ACK
+        CORRUPT   = 0x08   // a received frame failed its checksum
+    };
+
+    uint32_t time;   // micros()
+    uint8_t  flags;
+    uint8_t  msgid;
+    uint16_t param;
+};
+
+// Records the traffic with the module in a ring buffer, so that the most
+// recent events can be dumped when something goes wrong.  Recording a frame
+// takes a few microseconds, unlike printing it, so tracing barely changes the
+// timing being investigated.  (See `SerialAudio::useTrace` and TraceBuffer.)
+//
+// `dump` writes the records in a compact binary format that
+// extras/host/replay.cpp can read:  the bytes "SAT1", a 16-bit record count,
+// and then the records, oldest first, each as a 32-bit time, the flags, the
+// message ID, and a 16-bit parameter.  Multi-byte values are little-endian.
+class Trace {
+    public:
+        Trace(TraceRecord *records, uint16_t capacity) :
+            m_records(records), m_capacity(capacity) {}
+
+        void clear() { m_next = 0; m_count = 0; }
+        uint16_t size() const { return m_count; }
+
+        // Records are indexed from the oldest.  Assumes index < size().
+        TraceRecord const &operator[](uint16_t index) const {
+            auto const first = m_count < m_capacity ? 0 : m_next;
+            return m_records[(first + index) % m_capacity];
+        }
+
+        void record(uint8_t flags, Message::ID msgid, uint16_t param) {
+            m_records[m_next] =
+                TraceRecord{micros(), flags, static_cast<uint8_t>(msgid), param};
+            m_next = (m_next + 1) % m_capacity;
+            if (m_count < m_capacity) ++m_count;
+        }
+
+        void dump(Print &out) const {
+            out.write(reinterpret_cast<uint8_t const *>("SAT1"), 4);
+            put16(out, m_count);
+            for (uint16_t i = 0; i < m_count; ++i) {
+                auto const &r = (*this)[i];
+                put16(out, static_cast<uint16_t>(r.time));
+                put16(out, static_cast<uint16_t>(r.time >> 16));
+                out.write(r.flags);
+                out.write(r.msgid);
+                put16(out, r.param);
+            }
+        }
+
+    private:
+        static void put16(Print &out, uint16_t value) {
+            out.write(static_cast<uint8_t>(value & 0xFF));
+            out.write(static_cast<uint8_t>(value >> 8));
+        }
+
+        TraceRecord *m_records;
+        uint16_t     m_capacity;
+        uint16_t     m_next = 0;
+        uint16_t     m_count = 0;
+};
+
+// A Trace with room for CAPACITY records (8 bytes each).
+template <uint16_t CAPACITY = 32>
+class TraceBuffer : public Trace {
+    public:
+        TraceBuffer() : Trace(m_storage, CAPACITY) {}
+
+    private:
+        static_assert(CAPACITY > 0, "TraceBuffer needs room for a record");
+        TraceRecord m_storage[CAPACITY];
+};
+
+}
+
+#endif